@@ -0,0 +1,288 @@
+#pragma once
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cstdlib>
+#include <sys/mman.h>
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+/**
+* Arena of fixed size, 4 KB aligned I/O blocks in power of two size classes from 4 KB to 1 MB.
+* Released blocks go to a per class lock free free list and are never returned to the OS until the arena dies,
+* so the write path does not allocate once the arena is warm. Only a miss (empty free list) takes a lock.
+* Misses allocate chunks of at least 64 KB, the VirtualAlloc allocation granularity, and carve them into blocks;
+* with largePages the chunks are large pages (2 MB).
+*/
+class BufferArena {
+public:
+    static const size_t Alignment = 4 * 1024;
+    static const size_t MinBlockSize = 4 * 1024;
+    static const size_t MaxBlockSize = 1024 * 1024;
+    static const size_t MinChunkSize = 64 * 1024;
+    static const int NumSizeClasses = 9;
+
+    BufferArena(bool largePages = false) : largePages(largePages), misses(0), acquires(0) {
+        for (auto & head : freeLists) {
+            head = 0;
+        }
+    }
+
+    ~BufferArena() {
+        for (auto chunk : chunks) {
+            FreeChunk(chunk);
+        }
+    }
+
+    BufferArena(const BufferArena &) = delete;
+    BufferArena & operator=(const BufferArena &) = delete;
+
+    static size_t BlockSize(size_t size) {
+        return MinBlockSize << SizeClass(size);
+    }
+
+    char * Acquire(size_t size) {
+        int sizeClass = SizeClass(size);
+        acquires.fetch_add(1, std::memory_order_relaxed);
+
+        char * block = Pop(sizeClass);
+        if (block == nullptr) {
+            block = Allocate(sizeClass);
+        }
+
+        return block;
+    }
+
+    void Release(char * block, size_t size) {
+        Push(SizeClass(size), block);
+    }
+
+    long long GetMisses() const {
+        return misses.load();
+    }
+
+    long long GetAcquires() const {
+        return acquires.load();
+    }
+
+    class ThreadCache;
+
+    /**
+    * Block owned by a ThreadCache, given back to it on destruction.
+    */
+    class Block {
+    public:
+        Block(ThreadCache & cache, char * data, size_t size) : cache(&cache), data(data), size(size) {}
+        Block(Block && other) : cache(other.cache), data(other.data), size(other.size) {
+            other.data = nullptr;
+        }
+        Block(const Block &) = delete;
+        Block & operator=(const Block &) = delete;
+
+        ~Block() {
+            if (data != nullptr) {
+                cache->Release(data, size);
+            }
+        }
+
+        char * Data() {
+            return data;
+        }
+
+        // Usable size; the block itself may be larger as it is rounded to the size class.
+        size_t Size() const {
+            return size;
+        }
+
+        char * begin() {
+            return data;
+        }
+
+        char * end() {
+            return data + size;
+        }
+
+    private:
+        ThreadCache * cache;
+        char * data;
+        size_t size;
+    };
+
+    /**
+    * Small per thread stash of free blocks in front of the shared free lists.
+    * Not thread safe - each writer thread keeps its own, and it must outlive the blocks acquired from it.
+    */
+    class ThreadCache {
+    public:
+        static const size_t BlocksPerClass = 16;
+
+        ThreadCache(BufferArena & arena) : arena(arena) {}
+        ThreadCache(const ThreadCache &) = delete;
+        ThreadCache & operator=(const ThreadCache &) = delete;
+
+        ~ThreadCache() {
+            for (int c = 0; c < NumSizeClasses; ++c) {
+                for (auto block : cached[c]) {
+                    arena.Push(c, block);
+                }
+            }
+        }
+
+        Block Acquire(size_t size) {
+            int sizeClass = SizeClass(size);
+            auto & stash = cached[sizeClass];
+            if (stash.empty()) {
+                return Block(*this, arena.Acquire(size), size);
+            }
+
+            arena.acquires.fetch_add(1, std::memory_order_relaxed);
+            char * block = stash.back();
+            stash.pop_back();
+            return Block(*this, block, size);
+        }
+
+        void Release(char * block, size_t size) {
+            int sizeClass = SizeClass(size);
+            auto & stash = cached[sizeClass];
+            if (stash.size() < BlocksPerClass) {
+                stash.push_back(block);
+            }
+            else {
+                arena.Push(sizeClass, block);
+            }
+        }
+
+    private:
+        BufferArena & arena;
+        std::vector<char *> cached[NumSizeClasses];
+    };
+
+private:
+    // Free list head packs the 4 KB aligned block address with an ABA tag bumped on every update.
+    static const int AddressBits = 40;
+    static const uint64_t AddressMask = (1ULL << AddressBits) - 1;
+    static const size_t LargePageSize = 2 * 1024 * 1024;
+
+    static int SizeClass(size_t size) {
+        if (size == 0 || size > MaxBlockSize) {
+            throw std::runtime_error("invalid buffer size");
+        }
+
+        int sizeClass = 0;
+        while ((MinBlockSize << sizeClass) < size) {
+            ++sizeClass;
+        }
+        return sizeClass;
+    }
+
+    static uint64_t Pack(char * block, uint64_t tag) {
+        return ((uint64_t)(uintptr_t)block / Alignment) | (tag << AddressBits);
+    }
+
+    static char * Unpack(uint64_t head) {
+        return (char *)(uintptr_t)((head & AddressMask) * Alignment);
+    }
+
+    void Push(int sizeClass, char * block) {
+        auto & head = freeLists[sizeClass];
+        uint64_t oldHead = head.load(std::memory_order_relaxed);
+        uint64_t newHead;
+        do {
+            char * next = Unpack(oldHead);
+            memcpy(block, &next, sizeof(next)); // free block holds the link to the next one
+            newHead = Pack(block, (oldHead >> AddressBits) + 1);
+        } while (!head.compare_exchange_weak(oldHead, newHead, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    char * Pop(int sizeClass) {
+        auto & head = freeLists[sizeClass];
+        uint64_t oldHead = head.load(std::memory_order_acquire);
+        uint64_t newHead;
+        char * block;
+        do {
+            block = Unpack(oldHead);
+            if (block == nullptr) {
+                return nullptr;
+            }
+
+            // block may be popped and overwritten by another thread meanwhile; memory stays mapped
+            // and the tag makes the CAS fail in that case.
+            char * next;
+            memcpy(&next, block, sizeof(next));
+            newHead = Pack(next, (oldHead >> AddressBits) + 1);
+        } while (!head.compare_exchange_weak(oldHead, newHead, std::memory_order_acquire, std::memory_order_acquire));
+
+        return block;
+    }
+
+    char * Allocate(int sizeClass) {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        size_t blockSize = MinBlockSize << sizeClass;
+        size_t chunkSize = largePages ? LargePageSize : (blockSize > MinChunkSize ? blockSize : MinChunkSize);
+
+        char * chunk = AllocateChunk(chunkSize);
+        {
+            std::lock_guard<std::mutex> lock(chunksMutex);
+            chunks.push_back(chunk);
+        }
+
+        // rest of the chunk goes to the free list.
+        for (size_t pos = blockSize; pos + blockSize <= chunkSize; pos += blockSize) {
+            Push(sizeClass, chunk + pos);
+        }
+
+        return chunk;
+    }
+
+    char * AllocateChunk(size_t size) {
+        char * chunk = nullptr;
+#ifdef _WIN32
+        if (largePages) {
+            // needs SeLockMemoryPrivilege, fall back to normal pages without it.
+            chunk = (char *)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        }
+        if (chunk == nullptr) {
+            chunk = (char *)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        }
+#else
+        void * memory = nullptr;
+        if (posix_memalign(&memory, largePages ? LargePageSize : Alignment, size) == 0) {
+            chunk = (char *)memory;
+        }
+#ifdef MADV_HUGEPAGE
+        if (chunk != nullptr && largePages) {
+            madvise(chunk, size, MADV_HUGEPAGE);
+        }
+#endif
+#endif
+        if (chunk == nullptr) {
+            throw std::runtime_error("failed to allocate buffer arena chunk");
+        }
+        if (((uintptr_t)chunk / Alignment) > AddressMask) {
+            throw std::runtime_error("buffer arena chunk address out of range");
+        }
+        return chunk;
+    }
+
+    static void FreeChunk(char * chunk) {
+#ifdef _WIN32
+        VirtualFree(chunk, 0, MEM_RELEASE);
+#else
+        free(chunk);
+#endif
+    }
+
+    bool largePages;
+    std::atomic<uint64_t> freeLists[NumSizeClasses];
+    std::atomic<long long> misses;
+    std::atomic<long long> acquires;
+    std::mutex chunksMutex;
+    std::vector<char *> chunks;
+};
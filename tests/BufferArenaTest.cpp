@@ -0,0 +1,101 @@
+#pragma once
+
+#include "pch.h"
+#include "BufferArena.h"
+
+#include <set>
+#include <thread>
+
+TEST(buffer_arena, blocks_are_aligned_and_rounded_to_size_class) {
+    EXPECT_EQ(4 * 1024, BufferArena::BlockSize(1));
+    EXPECT_EQ(4 * 1024, BufferArena::BlockSize(4 * 1024));
+    EXPECT_EQ(8 * 1024, BufferArena::BlockSize(4 * 1024 + 1));
+    EXPECT_EQ(1024 * 1024, BufferArena::BlockSize(1024 * 1024));
+
+    BufferArena arena;
+    try {
+        arena.Acquire(1024 * 1024 + 1);
+        EXPECT_TRUE(false) << "should throw";
+    }
+    catch (std::runtime_error &) {
+    }
+
+    for (size_t size = 1; size <= BufferArena::MaxBlockSize; size *= 3) {
+        char * block = arena.Acquire(size);
+        EXPECT_EQ(0, ((uintptr_t)block) % BufferArena::Alignment);
+        memset(block, 'a', BufferArena::BlockSize(size)); // whole block is usable
+        arena.Release(block, size);
+    }
+}
+
+TEST(buffer_arena, released_blocks_are_reused_without_misses) {
+    BufferArena arena;
+    std::vector<char *> blocks;
+    for (int i = 0; i < 10; ++i) {
+        blocks.push_back(arena.Acquire(4096));
+    }
+    EXPECT_EQ(1, arena.GetMisses()); // one 64 KB chunk holds 16 blocks of 4 KB
+    EXPECT_EQ(10, std::set<char *>(blocks.begin(), blocks.end()).size());
+
+    for (auto block : blocks) {
+        arena.Release(block, 4096);
+    }
+
+    std::set<char *> reused;
+    for (int i = 0; i < 10; ++i) {
+        reused.insert(arena.Acquire(4096));
+    }
+    EXPECT_EQ(1, arena.GetMisses());
+    EXPECT_EQ(std::set<char *>(blocks.begin(), blocks.end()), reused);
+    EXPECT_EQ(20, arena.GetAcquires());
+}
+
+TEST(buffer_arena, large_pages_carve_chunks) {
+    BufferArena arena(true);
+    std::vector<char *> blocks;
+    for (int i = 0; i < 512; ++i) {
+        blocks.push_back(arena.Acquire(4096));
+    }
+    EXPECT_EQ(1, arena.GetMisses()); // one 2 MB chunk holds 512 blocks of 4 KB
+    EXPECT_EQ(512, std::set<char *>(blocks.begin(), blocks.end()).size());
+}
+
+TEST(buffer_arena, concurrent_thread_caches_never_share_blocks) {
+    BufferArena arena;
+    const int num_threads = 8;
+    const int iterations = 10000;
+    std::atomic<bool> shared(false);
+
+    auto fn = [&](int index) {
+        BufferArena::ThreadCache cache(arena);
+        for (int i = 0; i < iterations; ++i) {
+            auto first = cache.Acquire(4096 * (1 + (i % 3)));
+            auto second = arena.Acquire(4096);
+            memset(first.Data(), index, first.Size());
+            memset(second, index, 4096);
+            for (auto c : first) {
+                if (c != (char)index) {
+                    shared = true;
+                }
+            }
+            for (int j = 0; j < 4096; ++j) {
+                if (second[j] != (char)index) {
+                    shared = true;
+                }
+            }
+            arena.Release(second, 4096);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) {
+        threads.push_back(std::thread(fn, i + 1));
+    }
+    for (auto & t : threads) {
+        t.join();
+    }
+
+    EXPECT_FALSE(shared);
+    EXPECT_EQ((long long)num_threads * iterations * 2, arena.GetAcquires());
+    EXPECT_GT((long long)num_threads * 4 * 3, arena.GetMisses()); // warm arena does not allocate
+}
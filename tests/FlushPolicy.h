@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+enum class FlushMode {
+    EveryRecord,
+    Never,
+    FixedInterval, // flush once the oldest unflushed record waited `maxDelay`
+    FixedBytes,    // flush once `batchBytes` are pending
+    LatencyTarget  // batchBytes or maxDelay, whichever comes first, both tuned to keep commit p99 under target
+};
+
+/**
+* Decides when the append path flushes a group of records.
+* In LatencyTarget mode it watches commit latencies over a window of records and tunes batch size and
+* maximum delay at runtime: halve both when window p99 misses the target, grow them by a quarter when
+* p99 is comfortably (20%) under it. So throughput is as high as the latency target allows.
+* Not thread safe - appenders share it under the same lock as the file.
+*/
+class FlushController {
+public:
+    typedef std::chrono::high_resolution_clock Clock;
+
+    static const long long MinBatchBytes = 4 * 1024;
+    static const long long MaxBatchBytes = 64 * 1024 * 1024;
+    static const long long MinDelayMicros = 50;
+    static const long long MaxDelayMicros = 100 * 1000;
+    static const int WindowSize = 1024;
+
+    static FlushController EveryRecord() {
+        return FlushController(FlushMode::EveryRecord, 0, 0, 0);
+    }
+
+    static FlushController Never() {
+        return FlushController(FlushMode::Never, 0, 0, 0);
+    }
+
+    static FlushController FixedInterval(long long maxDelayMicros) {
+        return FlushController(FlushMode::FixedInterval, 0, maxDelayMicros, 0);
+    }
+
+    static FlushController FixedBytes(long long batchBytes) {
+        return FlushController(FlushMode::FixedBytes, batchBytes, 0, 0);
+    }
+
+    static FlushController LatencyTarget(int targetP99Micros) {
+        if (targetP99Micros <= 0) {
+            throw std::runtime_error("invalid latency target");
+        }
+        return FlushController(FlushMode::LatencyTarget, MinBatchBytes, MinDelayMicros, targetP99Micros);
+    }
+
+    // Called after every append with the bytes not yet flushed, including the one just appended,
+    // and when the oldest of them was appended.
+    // Only runs when there is an append: if appends stop, maxDelay is not enforced here, see FlushDeadline.
+    bool ShouldFlush(long long pendingBytes, Clock::time_point oldestPending, Clock::time_point now) const {
+        auto waitedMicros = std::chrono::duration_cast<std::chrono::microseconds>(now - oldestPending).count();
+        switch (mode) {
+        case FlushMode::EveryRecord:
+            return true;
+        case FlushMode::Never:
+            return false;
+        case FlushMode::FixedInterval:
+            return waitedMicros >= maxDelayMicros;
+        case FlushMode::FixedBytes:
+            return pendingBytes >= batchBytes;
+        case FlushMode::LatencyTarget:
+            return pendingBytes >= batchBytes || waitedMicros >= maxDelayMicros;
+        }
+        return true;
+    }
+
+    // Latest time a group whose oldest record was appended at `oldestPending` may stay unflushed,
+    // or time_point::max() for policies without a time bound. A writer which can go idle flushes
+    // at this deadline from a timer or flusher thread, so maxDelay bounds the wait of every record.
+    Clock::time_point FlushDeadline(Clock::time_point oldestPending) const {
+        if (mode != FlushMode::FixedInterval && mode != FlushMode::LatencyTarget) {
+            return Clock::time_point::max();
+        }
+        return oldestPending + std::chrono::microseconds(maxDelayMicros);
+    }
+
+    // Commit latency of every appended record: from the start of its append until its group is flushed.
+    void OnCommit(int latencyMicros) {
+        if (mode != FlushMode::LatencyTarget) {
+            return;
+        }
+
+        window.push_back(latencyMicros);
+        if (window.size() < WindowSize) {
+            return;
+        }
+
+        auto p99 = window.begin() + (window.size() * 99) / 100;
+        std::nth_element(window.begin(), p99, window.end());
+        lastWindowP99 = *p99;
+        window.clear();
+
+        if (lastWindowP99 > targetP99Micros) {
+            batchBytes = Clamp(batchBytes / 2, MinBatchBytes, MaxBatchBytes);
+            maxDelayMicros = Clamp(maxDelayMicros / 2, MinDelayMicros, MaxDelayMicros);
+        }
+        else if (lastWindowP99 < (targetP99Micros * 4) / 5) {
+            batchBytes = Clamp(batchBytes + batchBytes / 4, MinBatchBytes, MaxBatchBytes);
+            maxDelayMicros = Clamp(maxDelayMicros + maxDelayMicros / 4, MinDelayMicros, MaxDelayMicros);
+        }
+    }
+
+    FlushMode GetMode() const {
+        return mode;
+    }
+
+    const char * GetModeName() const {
+        switch (mode) {
+        case FlushMode::EveryRecord:
+            return "every_record";
+        case FlushMode::Never:
+            return "never";
+        case FlushMode::FixedInterval:
+            return "fixed_interval";
+        case FlushMode::FixedBytes:
+            return "fixed_bytes";
+        case FlushMode::LatencyTarget:
+            return "latency_target";
+        }
+        return "unknown";
+    }
+
+    long long GetBatchBytes() const {
+        return batchBytes;
+    }
+
+    long long GetMaxDelayMicros() const {
+        return maxDelayMicros;
+    }
+
+    // p99 of the last full window in LatencyTarget mode, -1 before the first one.
+    int GetLastWindowP99() const {
+        return lastWindowP99;
+    }
+
+private:
+    FlushController(FlushMode mode, long long batchBytes, long long maxDelayMicros, int targetP99Micros)
+        : mode(mode), batchBytes(batchBytes), maxDelayMicros(maxDelayMicros), targetP99Micros(targetP99Micros),
+          lastWindowP99(-1) {
+        if (batchBytes < 0 || maxDelayMicros < 0) {
+            throw std::runtime_error("invalid flush policy");
+        }
+        window.reserve(WindowSize);
+    }
+
+    static long long Clamp(long long value, long long low, long long high) {
+        return value < low ? low : (value > high ? high : value);
+    }
+
+    FlushMode mode;
+    long long batchBytes;
+    long long maxDelayMicros;
+    int targetP99Micros;
+    int lastWindowP99;
+    std::vector<int> window;
+};
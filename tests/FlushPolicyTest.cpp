@@ -0,0 +1,87 @@
+#pragma once
+
+#include "pch.h"
+#include "FlushPolicy.h"
+
+TEST(flush_policy, fixed_modes) {
+    auto now = FlushController::Clock::now();
+    auto older = now - std::chrono::microseconds(500);
+
+    EXPECT_TRUE(FlushController::EveryRecord().ShouldFlush(1, now, now));
+    EXPECT_FALSE(FlushController::Never().ShouldFlush(1LL << 40, older, now));
+
+    auto bytes = FlushController::FixedBytes(8192);
+    EXPECT_FALSE(bytes.ShouldFlush(4096, older, now));
+    EXPECT_TRUE(bytes.ShouldFlush(8192, now, now));
+
+    auto interval = FlushController::FixedInterval(400);
+    EXPECT_FALSE(interval.ShouldFlush(1LL << 40, now, now));
+    EXPECT_TRUE(interval.ShouldFlush(1, older, now));
+
+    try {
+        FlushController::FixedBytes(-1);
+        EXPECT_TRUE(false) << "should throw";
+    }
+    catch (std::runtime_error &) {
+    }
+}
+
+TEST(flush_policy, latency_target_tracks_target) {
+    auto controller = FlushController::LatencyTarget(1000);
+    EXPECT_EQ((long long)FlushController::MinBatchBytes, controller.GetBatchBytes());
+    EXPECT_EQ(-1, controller.GetLastWindowP99());
+
+    // well under target: grows every window.
+    long long lastBatch = controller.GetBatchBytes();
+    for (int w = 0; w < 10; ++w) {
+        for (int i = 0; i < FlushController::WindowSize; ++i) {
+            controller.OnCommit(100);
+        }
+        EXPECT_LT(lastBatch, controller.GetBatchBytes());
+        lastBatch = controller.GetBatchBytes();
+    }
+    EXPECT_EQ(100, controller.GetLastWindowP99());
+    long long grownDelay = controller.GetMaxDelayMicros();
+    EXPECT_LT((long long)FlushController::MinDelayMicros, grownDelay);
+
+    // 2% of commits over target puts p99 over it: halves.
+    for (int i = 0; i < FlushController::WindowSize; ++i) {
+        controller.OnCommit(i % 50 == 0 ? 5000 : 100);
+    }
+    EXPECT_EQ(5000, controller.GetLastWindowP99());
+    EXPECT_EQ(lastBatch / 2, controller.GetBatchBytes());
+    EXPECT_EQ(grownDelay / 2, controller.GetMaxDelayMicros());
+
+    // close to target: holds.
+    lastBatch = controller.GetBatchBytes();
+    for (int i = 0; i < FlushController::WindowSize; ++i) {
+        controller.OnCommit(900);
+    }
+    EXPECT_EQ(lastBatch, controller.GetBatchBytes());
+
+    // never below minimum.
+    for (int w = 0; w < 100; ++w) {
+        for (int i = 0; i < FlushController::WindowSize; ++i) {
+            controller.OnCommit(5000);
+        }
+    }
+    EXPECT_EQ((long long)FlushController::MinBatchBytes, controller.GetBatchBytes());
+    EXPECT_EQ((long long)FlushController::MinDelayMicros, controller.GetMaxDelayMicros());
+
+    // batch size or delay, whichever is first.
+    auto now = FlushController::Clock::now();
+    EXPECT_TRUE(controller.ShouldFlush(FlushController::MinBatchBytes, now, now));
+    EXPECT_TRUE(controller.ShouldFlush(1, now - std::chrono::microseconds((long long)FlushController::MinDelayMicros), now));
+    EXPECT_FALSE(controller.ShouldFlush(1, now, now));
+}
+
+TEST(flush_policy, flush_deadline) {
+    auto now = FlushController::Clock::now();
+    EXPECT_TRUE(FlushController::Clock::time_point::max() == FlushController::EveryRecord().FlushDeadline(now));
+    EXPECT_TRUE(FlushController::Clock::time_point::max() == FlushController::Never().FlushDeadline(now));
+    EXPECT_TRUE(FlushController::Clock::time_point::max() == FlushController::FixedBytes(4096).FlushDeadline(now));
+
+    EXPECT_TRUE(now + std::chrono::microseconds(400) == FlushController::FixedInterval(400).FlushDeadline(now));
+    auto target = FlushController::LatencyTarget(1000);
+    EXPECT_TRUE(now + std::chrono::microseconds(target.GetMaxDelayMicros()) == target.FlushDeadline(now));
+}
@@ -0,0 +1,260 @@
+#pragma once
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "LogRecord.h"
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+* Caller owned piece of a record, e.g. the header or the payload.
+*/
+struct Fragment {
+    const char * data;
+    size_t size;
+};
+
+/**
+* Collects record fragments without copying them and hands them to the sink in gather batches
+* of at most maxFragments, by default IOV_MAX where writev is used.
+* Caller must keep fragment memory alive until Flush returns.
+*/
+class GatherWriter {
+public:
+    typedef std::function<void(const Fragment * fragments, size_t count)> Sink;
+
+#ifdef _WIN32
+    static const size_t DefaultMaxFragments = 1024;
+#else
+    static const size_t DefaultMaxFragments = IOV_MAX;
+#endif
+
+    GatherWriter(Sink sink, size_t maxFragments = DefaultMaxFragments)
+        : sink(sink), maxFragments(maxFragments), bytesWritten(0), pendingBytes(0) {
+        if (maxFragments == 0) {
+            throw std::runtime_error("invalid max fragments");
+        }
+        pending.reserve(maxFragments);
+    }
+
+    // Writes every fragment straight from caller memory. There is no writev for std::ostream,
+    // so the batch becomes one write per fragment on the same stream - not a vectored write, see GatherFile.
+    static Sink StreamSink(std::ostream & stream) {
+        return [&stream](const Fragment * fragments, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                stream.write(fragments[i].data, fragments[i].size);
+            }
+
+            if (!stream) {
+                throw std::runtime_error("gather write to stream failed");
+            }
+        };
+    }
+
+    void Submit(const Fragment * fragments, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            if (pending.size() == maxFragments) {
+                WritePending();
+            }
+            pending.push_back(fragments[i]);
+            pendingBytes += fragments[i].size;
+        }
+    }
+
+    void SubmitRecord(const RecordHeader & header, const char * payload) {
+        Fragment fragments[]{
+            { (const char *)&header, sizeof(header) },
+            { payload, (size_t)header.size }
+        };
+        Submit(fragments, 2);
+    }
+
+    void Flush() {
+        if (!pending.empty()) {
+            WritePending();
+        }
+    }
+
+    size_t GetPendingFragments() const {
+        return pending.size();
+    }
+
+    long long GetBytesWritten() const {
+        return bytesWritten;
+    }
+
+private:
+    void WritePending() {
+        sink(pending.data(), pending.size());
+        bytesWritten += pendingBytes;
+        pending.clear();
+        pendingBytes = 0;
+    }
+
+    Sink sink;
+    size_t maxFragments;
+    std::vector<Fragment> pending;
+    long long bytesWritten;
+    long long pendingBytes;
+};
+
+/**
+* Append only log file which writes a whole gather batch with one vectored write call.
+* On POSIX that is writev, which takes fragments of any size and alignment.
+* On Win32 it is WriteFileGather, which needs an unbuffered handle and whole, page aligned pages,
+* so AcceptsAnyFragments is false there and other fragments throw.
+*/
+class GatherFile {
+public:
+#ifdef _WIN32
+    static const bool AcceptsAnyFragments = false;
+#else
+    static const bool AcceptsAnyFragments = true;
+#endif
+    static const size_t PageSize = 4 * 1024;
+
+    GatherFile(const std::string & filename) : writeCalls(0) {
+#ifdef _WIN32
+        handle = CreateFileA(filename.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS,
+            FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED, NULL);
+        if (handle == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("failed to open gather file: " + filename);
+        }
+
+        LARGE_INTEGER size;
+        event = CreateEventA(NULL, TRUE, FALSE, NULL);
+        if (event == NULL || !GetFileSizeEx(handle, &size) || (size.QuadPart % PageSize) != 0) {
+            CloseHandle(handle);
+            throw std::runtime_error("gather file must end on a page boundary: " + filename);
+        }
+        fileOffset = size.QuadPart;
+#else
+        fd = open(filename.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("failed to open gather file: " + filename);
+        }
+#endif
+    }
+
+    ~GatherFile() {
+#ifdef _WIN32
+        CloseHandle(event);
+        CloseHandle(handle);
+#else
+        close(fd);
+#endif
+    }
+
+    GatherFile(const GatherFile &) = delete;
+    GatherFile & operator=(const GatherFile &) = delete;
+
+    GatherWriter::Sink Sink() {
+        return [this](const Fragment * fragments, size_t count) {
+            Write(fragments, count);
+        };
+    }
+
+    // Appends all fragments, in order, with one write call unless the OS takes only part of it.
+    void Write(const Fragment * fragments, size_t count) {
+#ifdef _WIN32
+        segments.clear();
+        DWORD total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (((uintptr_t)fragments[i].data % PageSize) != 0 || (fragments[i].size % PageSize) != 0) {
+                throw std::runtime_error("WriteFileGather takes whole, page aligned pages only");
+            }
+
+            for (size_t pos = 0; pos < fragments[i].size; pos += PageSize) {
+                FILE_SEGMENT_ELEMENT segment;
+                segment.Buffer = PtrToPtr64(fragments[i].data + pos);
+                segments.push_back(segment);
+            }
+            total += (DWORD)fragments[i].size;
+        }
+
+        FILE_SEGMENT_ELEMENT terminator;
+        terminator.Alignment = 0;
+        segments.push_back(terminator);
+
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = (DWORD)fileOffset;
+        overlapped.OffsetHigh = (DWORD)(fileOffset >> 32);
+        overlapped.hEvent = event;
+        DWORD written = 0;
+        if ((!WriteFileGather(handle, segments.data(), total, NULL, &overlapped) && GetLastError() != ERROR_IO_PENDING)
+            || !GetOverlappedResult(handle, &overlapped, &written, TRUE) || written != total) {
+            throw std::runtime_error("gather write failed");
+        }
+
+        writeCalls += 1;
+        fileOffset += total;
+#else
+        iovecs.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            iovecs[i].iov_base = (void *)fragments[i].data;
+            iovecs[i].iov_len = fragments[i].size;
+        }
+
+        size_t next = 0;
+        while (true) {
+            while (next < count && iovecs[next].iov_len == 0) {
+                ++next;
+            }
+            if (next == count) {
+                break;
+            }
+
+            ssize_t written = writev(fd, iovecs.data() + next, (int)(count - next));
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("gather write failed");
+            }
+            writeCalls += 1;
+
+            // short write: continue from the first byte not written.
+            size_t left = (size_t)written;
+            while (left > 0) {
+                size_t step = left < iovecs[next].iov_len ? left : iovecs[next].iov_len;
+                iovecs[next].iov_base = (char *)iovecs[next].iov_base + step;
+                iovecs[next].iov_len -= step;
+                left -= step;
+                if (iovecs[next].iov_len == 0) {
+                    ++next;
+                }
+            }
+        }
+#endif
+    }
+
+    // Write system calls made so far, one per batch unless writes came up short.
+    long long GetWriteCalls() const {
+        return writeCalls;
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE handle;
+    HANDLE event;
+    long long fileOffset;
+    std::vector<FILE_SEGMENT_ELEMENT> segments;
+#else
+    int fd;
+    std::vector<iovec> iovecs;
+#endif
+    long long writeCalls;
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "pch.h"
+#include "GatherWriter.h"
+
+#include <fstream>
+#include <sstream>
+
+TEST(gather_writer, writes_fragments_in_order_without_copy) {
+    std::vector<const char *> seen;
+    std::vector<size_t> batchSizes;
+    GatherWriter writer([&](const Fragment * fragments, size_t count) {
+        batchSizes.push_back(count);
+        for (size_t i = 0; i < count; ++i) {
+            seen.push_back(fragments[i].data);
+        }
+    }, 4);
+
+    char data[10][8];
+    for (auto & d : data) {
+        Fragment f{ d, sizeof(d) };
+        writer.Submit(&f, 1);
+    }
+    EXPECT_EQ(2, writer.GetPendingFragments());
+    writer.Flush();
+
+    EXPECT_EQ((std::vector<size_t>{4, 4, 2}), batchSizes);
+    ASSERT_EQ(10, seen.size());
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(data[i], seen[i]); // same memory, no staging copy
+    }
+    EXPECT_EQ(80, writer.GetBytesWritten());
+    EXPECT_EQ(0, writer.GetPendingFragments());
+}
+
+TEST(gather_writer, writes_records_to_stream) {
+    std::ostringstream stream;
+    GatherWriter writer(GatherWriter::StreamSink(stream));
+
+    std::string payloads[]{ "first", "second record" };
+    RecordHeader headers[2];
+    for (int i = 0; i < 2; ++i) {
+        headers[i] = RecordHeader{ i + 1, (int)payloads[i].size(), 0 };
+        writer.SubmitRecord(headers[i], payloads[i].data());
+    }
+    writer.Flush();
+
+    std::string out = stream.str();
+    ASSERT_EQ(2 * sizeof(RecordHeader) + payloads[0].size() + payloads[1].size(), out.size());
+
+    size_t pos = 0;
+    for (int i = 0; i < 2; ++i) {
+        RecordHeader header;
+        memcpy(&header, out.data() + pos, sizeof(header));
+        pos += sizeof(header);
+        EXPECT_EQ(i + 1, header.lsn);
+        EXPECT_EQ(payloads[i], out.substr(pos, header.size));
+        pos += header.size;
+    }
+}
+
+TEST(gather_writer, gather_file_writes_batch_in_one_call) {
+    if (!GatherFile::AcceptsAnyFragments) {
+        return; // WriteFileGather takes whole pages only, covered below.
+    }
+
+    std::string filename = "gather1.log";
+    std::remove(filename.c_str());
+    std::string payloads[]{ "first", "", "third record" };
+    RecordHeader headers[3];
+    {
+        GatherFile file(filename);
+        GatherWriter writer(file.Sink());
+        for (int i = 0; i < 3; ++i) {
+            headers[i] = RecordHeader{ i + 1, (int)payloads[i].size(), 0 };
+            writer.SubmitRecord(headers[i], payloads[i].data());
+        }
+        writer.Flush();
+        EXPECT_EQ(1, file.GetWriteCalls());
+    }
+
+    std::ifstream in(filename, std::ios_base::in | std::ios_base::binary);
+    for (int i = 0; i < 3; ++i) {
+        RecordHeader header;
+        in.read((char *)&header, sizeof(header));
+        std::string payload(header.size, 0);
+        in.read(&payload[0], header.size);
+        EXPECT_TRUE(in);
+        EXPECT_EQ(i + 1, header.lsn);
+        EXPECT_EQ(payloads[i], payload);
+    }
+    EXPECT_EQ(EOF, in.peek());
+    in.close();
+    std::remove(filename.c_str());
+}
+
+TEST(gather_writer, gather_file_writes_pages) {
+    std::string filename = "gather2.log";
+    std::remove(filename.c_str());
+    alignas(4096) static char pages[3][4096];
+    for (int i = 0; i < 3; ++i) {
+        std::fill(pages[i], pages[i] + sizeof(pages[i]), (char)('a' + i));
+    }
+
+    {
+        GatherFile file(filename);
+        // pages out of memory order, file must follow fragment order.
+        Fragment fragments[]{ { pages[2], sizeof(pages[2]) }, { pages[0], 2 * sizeof(pages[0]) } };
+        file.Write(fragments, 2);
+        EXPECT_EQ(1, file.GetWriteCalls());
+    }
+
+    std::ifstream in(filename, std::ios_base::in | std::ios_base::binary);
+    std::string actual((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(std::string(4096, 'c') + std::string(4096, 'a') + std::string(4096, 'b'), actual);
+    in.close();
+    std::remove(filename.c_str());
+}
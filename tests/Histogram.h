@@ -1,55 +1,59 @@
 #pragma once
 
 #include "MetricRecorder.h"
-#include <unordered_map>
-#include <set>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
 
+/**
+* Percentiles across all recorders.
+* Each recorder is counted into a sorted (latency, count) partial histogram on a worker of one pool,
+* and the partials are then merged pairwise in parallel rounds on the same pool until one is left.
+*/
 class Histogram {
 public:
+    typedef std::vector<std::pair<int, long long>> Counts;
+
     Histogram(const std::vector<MetricRecorder> & recorders) : recorders(recorders) {}
 
     std::vector<int> GetPercentiles(std::vector<double> percentileAt) {
-        int count = 0;
-        std::unordered_map<int, int> latencyCount;
-        std::set<int> keys;
-
-        // Merge data for each recorder
-        for (auto & recorder : recorders) {
-            auto recorderIt = recorder.GetIterator();
-            while (recorderIt.HasNext()) {
-                auto val = recorderIt.GetNext();
-                auto latencyIt = latencyCount.insert(std::make_pair(val, 1));
-                if (!latencyIt.second) {
-                    latencyIt.first->second += 1;
-                }
-
-                count += 1;
+        return GetPercentiles(Merge(), percentileAt);
+    }
 
-                keys.insert(val);
-            }
+    // Percentiles of an already merged histogram.
+    static std::vector<int> GetPercentiles(const Counts & merged, std::vector<double> percentileAt) {
+        long long count = 0;
+        for (auto & latency : merged) {
+            count += latency.second;
         }
 
-        std::vector<int> percentileCount;
+        std::vector<long long> percentileCount;
         for (auto pAt : percentileAt) {
             if (pAt > 1.0) {
                 throw std::runtime_error("Invalid input");
             }
 
-            percentileCount.push_back((int)(pAt * count));
+            percentileCount.push_back((long long)(pAt * count));
         }
 
-        int tmpCount = 0;
+        long long tmpCount = 0;
         int index = 0;
 
         std::vector<int> percentiles(percentileCount.size());
         int lastKey = INT_MIN;
-        for (auto k : keys) {
+        for (auto & latency : merged) {
+            int k = latency.first;
             if (lastKey >= k) {
                 assert(false); // should see keys in increasing order.
             }
             lastKey = k;
 
-            tmpCount += latencyCount[k];
+            tmpCount += latency.second;
 
             for (int i = index; i < percentileCount.size(); ++i) {
                 if (tmpCount >= percentileCount[i]) {
@@ -77,6 +81,220 @@ public:
             std::cout << pAt[i] << " => " << ps[i] << std::endl;
         }
     }
+
+    // Sorted (latency, count) pairs of all recorders together.
+    Counts Merge() const {
+        // checked up front, so workers never throw on a partly filled recorder.
+        for (auto & recorder : recorders) {
+            if (!recorder.IsFull()) {
+                throw std::runtime_error("Buckets can only be read after filling all slots.");
+            }
+        }
+
+        std::vector<Counts> partials(recorders.size()); // outlives the pool's workers
+        WorkerPool pool(std::min<size_t>(recorders.size(), std::max<unsigned>(1U, std::thread::hardware_concurrency())));
+        pool.ParallelFor(recorders.size(), [&](size_t i) {
+            partials[i] = PartialCounts(recorders[i]);
+        });
+
+        // tree reduction: partial i merges with partial i + stride.
+        for (size_t stride = 1; stride < partials.size(); stride *= 2) {
+            size_t pairs = (partials.size() + (2 * stride) - 1) / (2 * stride);
+            pool.ParallelFor(pairs, [&](size_t p) {
+                size_t left = p * 2 * stride;
+                size_t right = left + stride;
+                if (right < partials.size()) {
+                    partials[left] = MergeCounts(partials[left], partials[right]);
+                    Counts().swap(partials[right]);
+                }
+            });
+        }
+
+        return partials.empty() ? Counts() : std::move(partials[0]);
+    }
+
 private:
+    // Latencies in [0, DenseLatencies) microseconds are counted in place; only the rest is sorted.
+    static const int DenseLatencies = 64 * 1024;
+
+    // One linear pass over the samples, no sort of the bulk of them.
+    static Counts PartialCounts(const MetricRecorder & recorder) {
+        std::vector<long long> dense(DenseLatencies);
+        std::vector<int> outliers;
+        int maxDense = -1;
+        for (int b = 0; b < recorder.GetBucketCount(); ++b) {
+            int count = 0;
+            const int * bucket = recorder.GetBucket(b, count);
+            for (int i = 0; i < count; ++i) {
+                int v = bucket[i];
+                if (v >= 0 && v < DenseLatencies) {
+                    dense[v] += 1;
+                    maxDense = v > maxDense ? v : maxDense;
+                }
+                else {
+                    outliers.push_back(v);
+                }
+            }
+        }
+        std::sort(outliers.begin(), outliers.end());
+
+        Counts counts;
+        size_t o = 0;
+        for (; o < outliers.size() && outliers[o] < 0; ++o) {
+            AddSample(counts, outliers[o]);
+        }
+        for (int v = 0; v <= maxDense; ++v) {
+            if (dense[v] != 0) {
+                counts.push_back(std::make_pair(v, dense[v]));
+            }
+        }
+        for (; o < outliers.size(); ++o) {
+            AddSample(counts, outliers[o]);
+        }
+        return counts;
+    }
+
+    static void AddSample(Counts & counts, int v) {
+        if (counts.empty() || counts.back().first != v) {
+            counts.push_back(std::make_pair(v, 0LL));
+        }
+        counts.back().second += 1;
+    }
+
+    static Counts MergeCounts(const Counts & left, const Counts & right) {
+        Counts merged;
+        merged.reserve(left.size() + right.size());
+        size_t l = 0, r = 0;
+        while (l < left.size() || r < right.size()) {
+            if (r == right.size() || (l < left.size() && left[l].first < right[r].first)) {
+                merged.push_back(left[l++]);
+            }
+            else if (l == left.size() || right[r].first < left[l].first) {
+                merged.push_back(right[r++]);
+            }
+            else {
+                merged.push_back(std::make_pair(left[l].first, left[l].second + right[r].second));
+                ++l;
+                ++r;
+            }
+        }
+        return merged;
+    }
+
+    /**
+    * Threads started once per Merge and reused by every round. The caller works too,
+    * so a pool of `numThreads` starts `numThreads - 1` threads.
+    */
+    class WorkerPool {
+    public:
+        typedef std::function<void(size_t)> Task;
+
+        WorkerPool(size_t numThreads) : task(nullptr), taskSize(0), next(0), generation(0), active(0), stop(false) {
+            for (size_t t = 1; t < numThreads; ++t) {
+                threads.push_back(std::thread([this]() { Work(); }));
+            }
+        }
+
+        ~WorkerPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            wake.notify_all();
+            for (auto & t : threads) {
+                t.join();
+            }
+        }
+
+        WorkerPool(const WorkerPool &) = delete;
+        WorkerPool & operator=(const WorkerPool &) = delete;
+
+        // Runs fn(0..n-1) on the pool and returns when all are done.
+        // The first exception thrown by fn stops the remaining calls and is rethrown once every worker finished.
+        void ParallelFor(size_t n, const Task & fn) {
+            if (threads.empty()) {
+                for (size_t i = 0; i < n; ++i) {
+                    fn(i);
+                }
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                task = &fn;
+                taskSize = n;
+                next = 0;
+                error = nullptr;
+                active = threads.size();
+                ++generation;
+            }
+            wake.notify_all();
+
+            Run(fn, n);
+
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [&]() { return active == 0; });
+            task = nullptr;
+            if (error) {
+                std::exception_ptr e = error;
+                error = nullptr;
+                std::rethrow_exception(e);
+            }
+        }
+
+    private:
+        void Work() {
+            long long seen = 0;
+            while (true) {
+                const Task * fn;
+                size_t n;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [&]() { return stop || generation != seen; });
+                    if (stop) {
+                        return;
+                    }
+                    seen = generation;
+                    fn = task;
+                    n = taskSize;
+                }
+
+                Run(*fn, n);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--active == 0) {
+                    done.notify_one();
+                }
+            }
+        }
+
+        void Run(const Task & fn, size_t n) {
+            try {
+                for (size_t i = next++; i < n; i = next++) {
+                    fn(i);
+                }
+            }
+            catch (...) {
+                next = n;
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        const Task * task;
+        size_t taskSize;
+        std::atomic<size_t> next;
+        long long generation;
+        size_t active;
+        bool stop;
+        std::exception_ptr error; // first exception of the running ParallelFor
+    };
+
     const std::vector<MetricRecorder> & recorders;
-};
\ No newline at end of file
+};
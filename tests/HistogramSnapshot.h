@@ -0,0 +1,277 @@
+#pragma once
+
+#include "Histogram.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <string>
+
+/**
+* Latency histogram of one benchmark run together with the run's parameters, persisted so that runs can be compared later.
+* Binary format: magic, version, name, parameters as (key, value) strings, then the merged (latency, count) pairs.
+*/
+class HistogramSnapshot {
+public:
+    typedef std::vector<std::pair<std::string, std::string>> Parameters;
+
+    HistogramSnapshot() {}
+
+    HistogramSnapshot(const std::string & name, const Parameters & parameters, const Histogram::Counts & counts)
+        : name(name), parameters(parameters), counts(counts) {}
+
+    static HistogramSnapshot FromRecorders(const std::string & name, const Parameters & parameters,
+        const std::vector<MetricRecorder> & recorders) {
+        return HistogramSnapshot(name, parameters, Histogram(recorders).Merge());
+    }
+
+    // Runs with the same key measure the same thing and are comparable.
+    std::string Key() const {
+        std::string key = name;
+        for (auto & parameter : parameters) {
+            key += "_" + parameter.first + "-" + parameter.second;
+        }
+
+        for (auto & c : key) {
+            if (!isalnum((unsigned char)c) && c != '_' && c != '-' && c != '.') {
+                c = '_';
+            }
+        }
+        return key;
+    }
+
+    std::vector<int> GetPercentiles(const std::vector<double> & percentileAt) const {
+        return Histogram::GetPercentiles(counts, percentileAt);
+    }
+
+    const std::string & GetName() const {
+        return name;
+    }
+
+    const Parameters & GetParameters() const {
+        return parameters;
+    }
+
+    const Histogram::Counts & GetCounts() const {
+        return counts;
+    }
+
+    void Save(const std::string & filename) const {
+        std::ofstream file(filename, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+        WriteValue(file, Magic);
+        WriteValue(file, Version);
+        WriteString(file, name);
+        WriteValue(file, (int)parameters.size());
+        for (auto & parameter : parameters) {
+            WriteString(file, parameter.first);
+            WriteString(file, parameter.second);
+        }
+
+        WriteValue(file, (long long)counts.size());
+        for (auto & latency : counts) {
+            WriteValue(file, latency.first);
+            WriteValue(file, latency.second);
+        }
+
+        file.flush();
+        if (!file) {
+            throw std::runtime_error("failed to save histogram snapshot: " + filename);
+        }
+    }
+
+    // Saves as `<dir>/<key>.<run>.hsnap` with the first unused run number, so repeated runs accumulate.
+    std::string SaveRun(const std::string & dir) const {
+        for (int run = 0;; ++run) {
+            std::string filename = dir + "/" + Key() + "." + std::to_string(run) + Extension();
+            if (!std::ifstream(filename)) {
+                Save(filename);
+                return filename;
+            }
+        }
+    }
+
+    static HistogramSnapshot Load(const std::string & filename) {
+        std::ifstream file(filename, std::ios_base::in | std::ios_base::binary);
+        if (ReadValue<int>(file) != Magic || ReadValue<int>(file) != Version) {
+            throw std::runtime_error("not a histogram snapshot: " + filename);
+        }
+
+        HistogramSnapshot snapshot;
+        snapshot.name = ReadString(file);
+        int numParameters = ReadValue<int>(file);
+        for (int i = 0; i < numParameters && file; ++i) {
+            std::string key = ReadString(file);
+            snapshot.parameters.push_back(std::make_pair(key, ReadString(file)));
+        }
+
+        long long numCounts = ReadValue<long long>(file);
+        for (long long i = 0; i < numCounts && file; ++i) {
+            int latency = ReadValue<int>(file);
+            snapshot.counts.push_back(std::make_pair(latency, ReadValue<long long>(file)));
+        }
+
+        if (!file || numParameters < 0 || numCounts < 0) {
+            throw std::runtime_error("corrupt histogram snapshot: " + filename);
+        }
+        return snapshot;
+    }
+
+    static std::string Extension() {
+        return ".hsnap";
+    }
+
+private:
+    static const int Magic = 0x50534e48; // "HNSP"
+    static const int Version = 1;
+    static const int MaxStringSize = 4096;
+
+    template<typename T>
+    static void WriteValue(std::ostream & out, T value) {
+        out.write((const char *)&value, sizeof(value));
+    }
+
+    template<typename T>
+    static T ReadValue(std::istream & in) {
+        T value = T();
+        in.read((char *)&value, sizeof(value));
+        return value;
+    }
+
+    static void WriteString(std::ostream & out, const std::string & value) {
+        WriteValue(out, (int)value.size());
+        out.write(value.data(), value.size());
+    }
+
+    static std::string ReadString(std::istream & in) {
+        int size = ReadValue<int>(in);
+        if (size < 0 || size > MaxStringSize) {
+            in.setstate(std::ios_base::failbit);
+            return std::string();
+        }
+
+        std::string value(size, 0);
+        in.read(&value[0], size);
+        return value;
+    }
+
+    std::string name;
+    Parameters parameters;
+    Histogram::Counts counts;
+};
+
+/**
+* Percentile by percentile comparison of repeated baseline runs against repeated candidate runs.
+* A percentile regresses when the candidate mean is worse than the baseline mean by more than `threshold`
+* (relative) and, with at least two runs on each side, Welch's t-test says the difference is significant at 95%.
+*/
+class SnapshotComparison {
+public:
+    struct Delta {
+        double percentile;
+        double baselineMean;
+        double candidateMean;
+        double change;       // relative change of the mean, positive is slower.
+        double tStatistic;   // NaN when there are not enough runs to tell.
+        bool significant;
+        bool regression;
+    };
+
+    static std::vector<Delta> Compare(const std::vector<HistogramSnapshot> & baseline,
+        const std::vector<HistogramSnapshot> & candidate, const std::vector<double> & percentileAt, double threshold) {
+        if (baseline.empty() || candidate.empty()) {
+            throw std::runtime_error("need at least one run on each side");
+        }
+
+        auto baselineRuns = PercentilesOfRuns(baseline, percentileAt);
+        auto candidateRuns = PercentilesOfRuns(candidate, percentileAt);
+
+        std::vector<Delta> deltas;
+        for (size_t p = 0; p < percentileAt.size(); ++p) {
+            double baselineMean, baselineVariance, candidateMean, candidateVariance;
+            MeanVariance(baselineRuns[p], baselineMean, baselineVariance);
+            MeanVariance(candidateRuns[p], candidateMean, candidateVariance);
+
+            Delta delta;
+            delta.percentile = percentileAt[p];
+            delta.baselineMean = baselineMean;
+            delta.candidateMean = candidateMean;
+            delta.change = (candidateMean - baselineMean) / (baselineMean > 1.0 ? baselineMean : 1.0);
+            delta.tStatistic = NAN;
+            delta.significant = true; // single runs: threshold alone decides.
+
+            size_t nb = baselineRuns[p].size(), nc = candidateRuns[p].size();
+            if (nb >= 2 && nc >= 2) {
+                double vb = baselineVariance / nb, vc = candidateVariance / nc;
+                if (vb + vc == 0) {
+                    delta.tStatistic = candidateMean == baselineMean ? 0 : INFINITY;
+                    delta.significant = candidateMean != baselineMean;
+                }
+                else {
+                    delta.tStatistic = (candidateMean - baselineMean) / std::sqrt(vb + vc);
+                    // Welch-Satterthwaite degrees of freedom.
+                    double df = ((vb + vc) * (vb + vc)) / ((vb * vb) / (nb - 1) + (vc * vc) / (nc - 1));
+                    delta.significant = std::fabs(delta.tStatistic) > CriticalT95(df);
+                }
+            }
+
+            delta.regression = delta.change > threshold && delta.significant;
+            deltas.push_back(delta);
+        }
+
+        return deltas;
+    }
+
+    static void Print(const std::string & key, const std::vector<Delta> & deltas) {
+        std::cout << key << std::endl;
+        std::cout << "Percentile => baseline, candidate (microseconds), change, t" << std::endl;
+        for (auto & delta : deltas) {
+            std::cout << delta.percentile << " => " << delta.baselineMean << ", " << delta.candidateMean << ", "
+                << std::showpos << std::fixed << std::setprecision(1) << delta.change * 100 << "%"
+                << std::noshowpos << ", " << std::setprecision(2) << delta.tStatistic
+                << std::defaultfloat << std::setprecision(6)
+                << (delta.regression ? " REGRESSION" : "") << std::endl;
+        }
+    }
+
+private:
+    // [percentile][run]
+    static std::vector<std::vector<double>> PercentilesOfRuns(const std::vector<HistogramSnapshot> & runs,
+        const std::vector<double> & percentileAt) {
+        std::vector<std::vector<double>> values(percentileAt.size());
+        for (auto & run : runs) {
+            auto ps = run.GetPercentiles(percentileAt);
+            for (size_t p = 0; p < ps.size(); ++p) {
+                values[p].push_back(ps[p]);
+            }
+        }
+        return values;
+    }
+
+    static void MeanVariance(const std::vector<double> & values, double & mean, double & variance) {
+        mean = 0;
+        for (auto v : values) {
+            mean += v;
+        }
+        mean /= values.size();
+
+        variance = 0;
+        for (auto v : values) {
+            variance += (v - mean) * (v - mean);
+        }
+        variance = values.size() > 1 ? variance / (values.size() - 1) : 0;
+    }
+
+    // Two sided 95% critical value of Student's t distribution.
+    static double CriticalT95(double df) {
+        static const double table[]{ 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+            2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+            2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+        int index = (int)std::floor(df);
+        if (index < 1) {
+            return table[0];
+        }
+        return index <= 30 ? table[index - 1] : 1.96;
+    }
+};
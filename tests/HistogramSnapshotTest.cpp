@@ -0,0 +1,80 @@
+#pragma once
+
+#include "pch.h"
+#include "HistogramSnapshot.h"
+
+namespace {
+    // run whose latencies are 1..size shifted by `shift`
+    HistogramSnapshot MakeRun(int size, int shift) {
+        MetricRecorder m(size);
+        for (int i = 0; i < size; ++i) {
+            m.Add(i + 1 + shift);
+        }
+        return HistogramSnapshot::FromRecorders("append", { { "threads", "4" }, { "flush", "true" } },
+            std::vector<MetricRecorder>{ m });
+    }
+}
+
+TEST(histogram_snapshot, save_load_round_trip) {
+    auto snapshot = MakeRun(1000, 0);
+    EXPECT_EQ("append_threads-4_flush-true", snapshot.Key());
+
+    std::string filename = "snapshot1.hsnap";
+    snapshot.Save(filename);
+    auto loaded = HistogramSnapshot::Load(filename);
+    std::remove(filename.c_str());
+
+    EXPECT_EQ(snapshot.GetName(), loaded.GetName());
+    EXPECT_EQ(snapshot.GetParameters(), loaded.GetParameters());
+    EXPECT_EQ(snapshot.GetCounts(), loaded.GetCounts());
+    EXPECT_EQ((std::vector<int>{ 500, 990 }), loaded.GetPercentiles({ .5, .99 }));
+
+    std::ofstream(filename) << "not a snapshot";
+    try {
+        HistogramSnapshot::Load(filename);
+        EXPECT_TRUE(false) << "should throw";
+    }
+    catch (std::runtime_error &) {
+    }
+    std::remove(filename.c_str());
+}
+
+TEST(histogram_snapshot, save_run_numbers_repeated_runs) {
+    auto snapshot = MakeRun(100, 0);
+    auto first = snapshot.SaveRun(".");
+    auto second = snapshot.SaveRun(".");
+    EXPECT_EQ("./append_threads-4_flush-true.0.hsnap", first);
+    EXPECT_EQ("./append_threads-4_flush-true.1.hsnap", second);
+    std::remove(first.c_str());
+    std::remove(second.c_str());
+}
+
+TEST(histogram_snapshot, comparison_flags_significant_regressions_only) {
+    std::vector<double> pAt{ .5, .99 };
+    std::vector<HistogramSnapshot> baseline{ MakeRun(1000, 0), MakeRun(1000, 2), MakeRun(1000, 4) };
+
+    // 20% slower everywhere, consistently across runs.
+    std::vector<HistogramSnapshot> slower{ MakeRun(1000, 100), MakeRun(1000, 102), MakeRun(1000, 104) };
+    auto deltas = SnapshotComparison::Compare(baseline, slower, pAt, 0.05);
+    ASSERT_EQ(2, deltas.size());
+    EXPECT_TRUE(deltas[0].regression);
+    EXPECT_NEAR(0.2, deltas[0].change, 0.01);
+    EXPECT_TRUE(deltas[1].regression);
+    EXPECT_NEAR(0.1, deltas[1].change, 0.01);
+    SnapshotComparison::Print(baseline[0].Key(), deltas);
+
+    deltas = SnapshotComparison::Compare(baseline, slower, pAt, 0.15);
+    EXPECT_TRUE(deltas[0].regression);
+    EXPECT_FALSE(deltas[1].regression); // p99 is only 10% slower
+
+    // same mean shift, but noisy runs: not significant.
+    std::vector<HistogramSnapshot> noisy{ MakeRun(1000, -300), MakeRun(1000, 500), MakeRun(1000, 100) };
+    deltas = SnapshotComparison::Compare(baseline, noisy, pAt, 0.05);
+    EXPECT_FALSE(deltas[0].significant);
+    EXPECT_FALSE(deltas[0].regression);
+
+    // faster is never a regression.
+    deltas = SnapshotComparison::Compare(slower, baseline, pAt, 0.05);
+    EXPECT_FALSE(deltas[0].regression);
+    EXPECT_FALSE(deltas[1].regression);
+}
@@ -59,3 +59,62 @@ TEST(histogram, unit_test1) {
     EXPECT_EQ(990, ps[3]);
     EXPECT_EQ(1000, ps[4]);
 }
+
+
+TEST(histogram, parallel_merge_matches_sorted_samples) {
+    int seed = (int)time(nullptr);
+    std::cout << "Random seed: " << seed << std::endl;
+    std::srand(seed);
+
+    int numMetrics = 64;
+    int size = 5000;
+    std::vector<int> all;
+    std::vector<MetricRecorder> recorders;
+    for (int i = 0; i < numMetrics; ++i) {
+        MetricRecorder m(size);
+        for (int j = 0; j < size; ++j) {
+            auto v = std::rand() % 2000; // plenty of duplicates across recorders
+            m.Add(v);
+            all.push_back(v);
+        }
+        recorders.push_back(m);
+    }
+    std::sort(all.begin(), all.end());
+
+    Histogram hgm(recorders);
+    auto merged = hgm.Merge();
+    long long total = 0;
+    for (size_t i = 0; i < merged.size(); ++i) {
+        total += merged[i].second;
+        if (i > 0) {
+            EXPECT_LT(merged[i - 1].first, merged[i].first);
+        }
+    }
+    EXPECT_EQ((long long)all.size(), total);
+
+    std::vector<double> pAt{ 0, .5, .9, .99, 1 };
+    auto ps = hgm.GetPercentiles(pAt);
+    for (size_t i = 0; i < pAt.size(); ++i) {
+        size_t rank = (size_t)(pAt[i] * all.size());
+        EXPECT_EQ(all[rank == 0 ? 0 : rank - 1], ps[i]) << "percentile " << pAt[i];
+    }
+}
+
+TEST(histogram, merge_rejects_partly_filled_recorder) {
+    std::vector<MetricRecorder> recorders;
+    for (int i = 0; i < 8; ++i) {
+        MetricRecorder m(100);
+        for (int j = 0; j < (i == 5 ? 50 : 100); ++j) {
+            m.Add(j);
+        }
+        recorders.push_back(m);
+    }
+
+    Histogram hgm(recorders);
+    try {
+        hgm.Merge();
+        EXPECT_TRUE(false) << "should throw";
+    }
+    catch (std::runtime_error &) {
+    }
+}
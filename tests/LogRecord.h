@@ -0,0 +1,13 @@
+#pragma once
+
+/**
+* On disk header in front of every WAL record payload.
+* Records are written as header followed by `size` bytes of payload, with no padding in between.
+*/
+struct RecordHeader {
+    long long lsn;
+    int size;
+    int reserved;
+};
+
+static_assert(sizeof(RecordHeader) == 16, "RecordHeader is part of the on disk format");
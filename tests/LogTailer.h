@@ -0,0 +1,216 @@
+#pragma once
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+/**
+* Forces data of a file down to stable storage. fstream::flush() only hands data to the OS,
+* so the writer syncs through a second handle to the same file before publishing an offset as durable.
+*/
+class FileSync {
+public:
+    FileSync(const std::string & filename) {
+#ifdef _WIN32
+        handle = CreateFileA(filename.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (handle == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("failed to open log for sync: " + filename);
+        }
+#else
+        fd = open(filename.c_str(), O_WRONLY);
+        if (fd < 0) {
+            throw std::runtime_error("failed to open log for sync: " + filename);
+        }
+#endif
+    }
+
+    ~FileSync() {
+#ifdef _WIN32
+        CloseHandle(handle);
+#else
+        close(fd);
+#endif
+    }
+
+    FileSync(const FileSync &) = delete;
+    FileSync & operator=(const FileSync &) = delete;
+
+    void Sync() {
+#ifdef _WIN32
+        bool synced = FlushFileBuffers(handle) != 0;
+#else
+        bool synced = fsync(fd) == 0;
+#endif
+        if (!synced) {
+            throw std::runtime_error("failed to sync log");
+        }
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    int fd;
+#endif
+};
+
+/**
+* Durable end of the log shared between the writer and tail readers.
+* Writer publishes the offset up to which data is synced to disk; readers block on the condition variable
+* instead of polling the file size. Offsets only move forward.
+* The last `MaxHistory` publishes are kept with their times, so a reader which fell behind can still tell
+* when each range it reads became durable. A reader more than that many publishes behind is told which of
+* its publishes were dropped, see LogTailReader::GetStaleReads.
+*/
+class DurableOffset {
+public:
+    typedef std::chrono::high_resolution_clock Clock;
+
+    struct PublishPoint {
+        long long offset;
+        Clock::time_point time;
+    };
+
+    static const size_t MaxHistory = 64 * 1024;
+
+    DurableOffset() : offset(0), closed(false), droppedUpTo(0) {}
+
+    // Data up to `newOffset` must already be synced, see FileSync.
+    void Publish(long long newOffset) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (newOffset < offset) {
+                throw std::runtime_error("durable offset can not move backwards");
+            }
+            offset = newOffset;
+            history.push_back(PublishPoint{ newOffset, Clock::now() });
+            if (history.size() > MaxHistory) {
+                droppedUpTo = history.front().offset;
+                history.pop_front();
+            }
+        }
+        cv.notify_all();
+    }
+
+    // Writer is done. Readers drain whatever is durable and then stop.
+    void Close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        cv.notify_all();
+    }
+
+    // Blocks until durable offset moves past `knownOffset` or writer closes. Returns the durable offset
+    // and appends publishes past `knownOffset`, and past the last one already in `publishes`, to `publishes`.
+    // If some of those were already dropped from the history, `lostUpTo` is set to the newest dropped offset.
+    long long WaitBeyond(long long knownOffset, std::deque<PublishPoint> & publishes, long long & lostUpTo) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return offset > knownOffset || closed; });
+
+        long long seen = publishes.empty() ? knownOffset : std::max<long long>(knownOffset, publishes.back().offset);
+        if (droppedUpTo > seen) {
+            lostUpTo = droppedUpTo;
+        }
+        auto it = std::upper_bound(history.begin(), history.end(), seen,
+            [](long long o, const PublishPoint & p) { return o < p.offset; });
+        publishes.insert(publishes.end(), it, history.end());
+        return offset;
+    }
+
+    bool IsClosed() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return closed;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    long long offset;
+    bool closed;
+    std::deque<PublishPoint> history;
+    long long droppedUpTo; // offset of the newest publish dropped from history
+};
+
+/**
+* Follows a log file while it is being appended to.
+* Only the newly durable range [readOffset, durableOffset) is read, directly into the caller's buffer.
+*/
+class LogTailReader {
+public:
+    LogTailReader(const std::string & filename, DurableOffset & durable, long long startOffset = 0)
+        : file(filename, std::fstream::in | std::fstream::binary), durable(durable),
+          readOffset(startOffset), durableOffset(startOffset), lostUpTo(-1), staleReads(0) {
+        if (!file) {
+            throw std::runtime_error("failed to open log for tailing: " + filename);
+        }
+    }
+
+    // Reads at most `size` bytes of durable data, waiting for the writer if everything durable is consumed.
+    // Returns 0 only when the writer has closed and all durable data is read.
+    // `publishedAt` is the time of the first publish which covered the end of the returned data,
+    // i.e. when this data became visible, even if the reader only gets to it several publishes later.
+    // If that publish was already dropped from the history, `publishedAt` is a later one and the read counts as stale.
+    size_t ReadNext(char * buffer, size_t size, DurableOffset::Clock::time_point & publishedAt) {
+        if (readOffset >= durableOffset) {
+            durableOffset = durable.WaitBeyond(readOffset, publishes, lostUpTo);
+            if (readOffset >= durableOffset) {
+                return 0; // closed and drained
+            }
+
+            // data past eof of previous read is now durable - drop eof and stale stream buffer.
+            file.clear();
+            file.seekg(readOffset, std::ios_base::beg);
+        }
+
+        size_t toRead = (size_t) std::min<long long>((long long) size, durableOffset - readOffset);
+        file.read(buffer, toRead);
+        if (file.gcount() != (std::streamsize) toRead) {
+            throw std::runtime_error("durable data could not be read from log");
+        }
+
+        readOffset += toRead;
+
+        // publishes are in offset order and the last one is at durableOffset, so one covering readOffset is left.
+        while (publishes.size() > 1 && publishes.front().offset < readOffset) {
+            publishes.pop_front();
+        }
+        publishedAt = publishes.front().time;
+        if (readOffset <= lostUpTo) {
+            staleReads += 1;
+        }
+        return toRead;
+    }
+
+    long long GetReadOffset() const {
+        return readOffset;
+    }
+
+    // Reads whose `publishedAt` is later than the publish which made them durable, as the reader
+    // fell more than DurableOffset::MaxHistory publishes behind. Their latency is understated.
+    long long GetStaleReads() const {
+        return staleReads;
+    }
+
+private:
+    std::ifstream file;
+    DurableOffset & durable;
+    long long readOffset;
+    long long durableOffset;
+    std::deque<DurableOffset::PublishPoint> publishes; // not yet fully read, oldest first
+    long long lostUpTo; // reads ending at or before this offset lost their publish
+    long long staleReads;
+};
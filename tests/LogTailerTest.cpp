@@ -0,0 +1,136 @@
+#pragma once
+
+#include "pch.h"
+#include "LogTailer.h"
+
+#include <thread>
+#include <vector>
+
+TEST(log_tailer, follows_appends_until_close) {
+    std::string filename = "tail1.log";
+    std::remove(filename.c_str());
+    {
+        std::fstream file(filename, std::fstream::out | std::fstream::trunc | std::fstream::binary);
+    }
+
+    const int num_records = 100;
+    const int record_size = 128;
+    DurableOffset durable;
+
+    std::string actual;
+    std::thread reader([&]() {
+        LogTailReader tailer(filename, durable);
+        char buffer[record_size];
+        std::chrono::high_resolution_clock::time_point publishedAt;
+        size_t read = 0;
+        while ((read = tailer.ReadNext(buffer, sizeof(buffer), publishedAt)) != 0) {
+            actual.append(buffer, read);
+        }
+    });
+
+    std::string expected;
+    {
+        std::fstream file(filename, std::fstream::app | std::fstream::binary);
+        long long written = 0;
+        for (int i = 0; i < num_records; ++i) {
+            std::string record(record_size, (char)('a' + (i % 26)));
+            file.write(record.data(), record.size());
+            file.flush();
+            written += record.size();
+            expected += record;
+            durable.Publish(written);
+        }
+    }
+    durable.Close();
+    reader.join();
+
+    EXPECT_EQ(expected, actual);
+    std::remove(filename.c_str());
+}
+
+TEST(log_tailer, durable_offset_does_not_move_backwards) {
+    DurableOffset durable;
+    durable.Publish(10);
+    try {
+        durable.Publish(5);
+        EXPECT_TRUE(false) << "should throw";
+    }
+    catch (std::runtime_error &) {
+    }
+}
+
+TEST(log_tailer, lagging_reader_times_each_record_against_its_own_publish) {
+    std::string filename = "tail2.log";
+    const int num_records = 3;
+    const int record_size = 64;
+    DurableOffset durable;
+    std::vector<DurableOffset::Clock::time_point> before_publish;
+    {
+        std::fstream file(filename, std::fstream::out | std::fstream::trunc | std::fstream::binary);
+        std::string record(record_size, 'x');
+        for (int i = 0; i < num_records; ++i) {
+            file.write(record.data(), record.size());
+            file.flush();
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            before_publish.push_back(DurableOffset::Clock::now());
+            durable.Publish((i + 1) * record_size);
+        }
+    }
+    durable.Close();
+    before_publish.push_back(DurableOffset::Clock::now());
+
+    // reader starts after all publishes, as if it fell behind.
+    LogTailReader tailer(filename, durable);
+    char buffer[record_size];
+    DurableOffset::Clock::time_point publishedAt;
+    for (int i = 0; i < num_records; ++i) {
+        EXPECT_EQ(record_size, tailer.ReadNext(buffer, sizeof(buffer), publishedAt));
+        EXPECT_TRUE(publishedAt >= before_publish[i]);
+        EXPECT_TRUE(publishedAt < before_publish[i + 1]);
+    }
+    EXPECT_EQ(0, tailer.ReadNext(buffer, sizeof(buffer), publishedAt));
+    std::remove(filename.c_str());
+}
+
+TEST(log_tailer, file_sync) {
+    std::string filename = "tail3.log";
+    {
+        std::fstream file(filename, std::fstream::out | std::fstream::trunc | std::fstream::binary);
+        file.write("data", 4);
+        file.flush();
+        FileSync sync(filename);
+        sync.Sync();
+    }
+    std::remove(filename.c_str());
+
+    try {
+        FileSync missing(filename);
+        EXPECT_TRUE(false) << "should throw";
+    }
+    catch (std::runtime_error &) {
+    }
+}
+
+TEST(log_tailer, counts_reads_whose_publish_was_dropped) {
+    std::string filename = "tail4.log";
+    const int dropped = 10;
+    const int num_publishes = (int)DurableOffset::MaxHistory + dropped;
+    DurableOffset durable;
+    {
+        std::fstream file(filename, std::fstream::out | std::fstream::trunc | std::fstream::binary);
+        file << std::string(num_publishes, 'x');
+    }
+    for (int i = 1; i <= num_publishes; ++i) {
+        durable.Publish(i);
+    }
+    durable.Close();
+
+    LogTailReader tailer(filename, durable);
+    char c;
+    DurableOffset::Clock::time_point publishedAt;
+    while (tailer.ReadNext(&c, 1, publishedAt) != 0) {
+    }
+    EXPECT_EQ(num_publishes, tailer.GetReadOffset());
+    EXPECT_EQ(dropped, tailer.GetStaleReads());
+    std::remove(filename.c_str());
+}
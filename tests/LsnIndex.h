@@ -0,0 +1,223 @@
+#pragma once
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cstdio>
+#endif
+
+#include "LogRecord.h"
+
+#include <algorithm>
+#include <fstream>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+* Sparse LSN => file offset index with one entry every `interval` records.
+* Writer adds every record in LSN order; recovery continues from the last record the index has seen.
+* After a checkpoint truncation the log before `startOffset` may be punched out; the index must be saved
+* before that, so that recovery resumes past the punched region from the saved scanned offset.
+* Lookup is a binary search to the closest entry at or before the LSN, followed by a walk of at most `interval` headers.
+*/
+class LsnIndex {
+public:
+    struct Entry {
+        long long lsn;
+        long long offset;
+    };
+
+    LsnIndex(int interval = 64) : interval(interval), recordsIndexed(0), lastLsn(0), scannedOffset(0), startOffset(0) {
+        if (interval <= 0) {
+            throw std::runtime_error("invalid index interval");
+        }
+    }
+
+    void Add(const RecordHeader & header, long long offset) {
+        if (header.lsn <= lastLsn) {
+            throw std::runtime_error("lsn must increase");
+        }
+
+        if ((recordsIndexed % interval) == 0) {
+            entries.push_back(Entry{ header.lsn, offset });
+        }
+
+        recordsIndexed += 1;
+        lastLsn = header.lsn;
+        scannedOffset = offset + sizeof(RecordHeader) + header.size;
+    }
+
+    // Closest entry at or before `lsn`. Returns false if `lsn` is before the first indexed record or after the last.
+    bool Lookup(long long lsn, Entry & entry) const {
+        if (lsn > lastLsn) {
+            return false;
+        }
+
+        auto it = std::upper_bound(entries.begin(), entries.end(), lsn,
+            [](long long l, const Entry & e) { return l < e.lsn; });
+        if (it == entries.begin()) {
+            return false;
+        }
+
+        entry = *(it - 1);
+        return true;
+    }
+
+    // Positions `log` at the payload of record `lsn`.
+    bool Seek(std::istream & log, long long lsn, RecordHeader & header) const {
+        Entry entry;
+        if (!Lookup(lsn, entry)) {
+            return false;
+        }
+
+        log.clear();
+        log.seekg(entry.offset, std::ios_base::beg);
+        while (log.read((char *)&header, sizeof(header))) {
+            if (header.lsn == lsn) {
+                return true;
+            }
+
+            if (header.lsn > lsn) {
+                break;
+            }
+            log.seekg(header.size, std::ios_base::cur);
+        }
+
+        return false;
+    }
+
+    // Checkpoint: forgets records before `lsn`, keeping the entry `lsn` itself is found from.
+    // Returns offset before which the log is no longer needed, or -1 if `lsn` is not indexed.
+    // Save the index before deallocating anything before the returned offset.
+    long long TruncateBefore(long long lsn) {
+        Entry entry;
+        if (!Lookup(lsn, entry)) {
+            return -1;
+        }
+
+        auto it = std::lower_bound(entries.begin(), entries.end(), entry.lsn,
+            [](const Entry & e, long long l) { return e.lsn < l; });
+        entries.erase(entries.begin(), it);
+        startOffset = entry.offset;
+        return entry.offset;
+    }
+
+    // Indexes records appended after the last indexed one. Never throws on log content:
+    // stops at the end of log or at the first header which is torn, zeroed (preallocated or punched) or out of sequence.
+    void Recover(std::istream & log) {
+        log.clear();
+        log.seekg(0, std::ios_base::end);
+        long long end = log.tellg();
+
+        long long offset = scannedOffset;
+        log.seekg(offset, std::ios_base::beg);
+        RecordHeader header;
+        while (offset + (long long)sizeof(header) <= end && log.read((char *)&header, sizeof(header))) {
+            if (header.size < 0 || offset + (long long)sizeof(header) + header.size > end) {
+                break; // torn record
+            }
+            if (header.lsn <= 0 || header.lsn <= lastLsn || (lastLsn != 0 && header.lsn != lastLsn + 1)) {
+                break; // zeroed region or garbage past the end of valid log
+            }
+
+            Add(header, offset);
+            offset = scannedOffset;
+            log.seekg(header.size, std::ios_base::cur);
+        }
+        log.clear();
+    }
+
+    // Writes `<filename>.tmp` and renames it over `filename`, so a crash during a save leaves the previous index intact.
+    void Save(const std::string & filename) const {
+        std::string tmpFilename = filename + ".tmp";
+        {
+            std::ofstream file(tmpFilename, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+            Write(file);
+            file.flush();
+            if (!file) {
+                throw std::runtime_error("failed to save lsn index: " + tmpFilename);
+            }
+        }
+
+#ifdef _WIN32
+        bool renamed = MoveFileExA(tmpFilename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        bool renamed = std::rename(tmpFilename.c_str(), filename.c_str()) == 0;
+#endif
+        if (!renamed) {
+            throw std::runtime_error("failed to replace lsn index: " + filename);
+        }
+    }
+
+    static LsnIndex Load(const std::string & filename) {
+        std::ifstream file(filename, std::ios_base::in | std::ios_base::binary);
+        int magic = 0;
+        file.read((char *)&magic, sizeof(magic));
+        if (!file || magic != Magic) {
+            throw std::runtime_error("not an lsn index: " + filename);
+        }
+
+        LsnIndex index;
+        long long count = 0;
+        file.read((char *)&index.interval, sizeof(index.interval));
+        file.read((char *)&index.recordsIndexed, sizeof(index.recordsIndexed));
+        file.read((char *)&index.lastLsn, sizeof(index.lastLsn));
+        file.read((char *)&index.scannedOffset, sizeof(index.scannedOffset));
+        file.read((char *)&index.startOffset, sizeof(index.startOffset));
+        file.read((char *)&count, sizeof(count));
+        if (!file || index.interval <= 0 || count < 0) {
+            throw std::runtime_error("corrupt lsn index: " + filename);
+        }
+
+        index.entries.resize((size_t)count);
+        file.read((char *)index.entries.data(), count * sizeof(Entry));
+        if (!file) {
+            throw std::runtime_error("corrupt lsn index: " + filename);
+        }
+
+        return index;
+    }
+
+    size_t GetEntryCount() const {
+        return entries.size();
+    }
+
+    long long GetLastLsn() const {
+        return lastLsn;
+    }
+
+    // Offset just past the last indexed record.
+    long long GetScannedOffset() const {
+        return scannedOffset;
+    }
+
+    // Offset of the first record kept by the last checkpoint, 0 before any.
+    long long GetStartOffset() const {
+        return startOffset;
+    }
+
+private:
+    void Write(std::ostream & file) const {
+        int magic = Magic;
+        long long count = entries.size();
+        file.write((const char *)&magic, sizeof(magic));
+        file.write((const char *)&interval, sizeof(interval));
+        file.write((const char *)&recordsIndexed, sizeof(recordsIndexed));
+        file.write((const char *)&lastLsn, sizeof(lastLsn));
+        file.write((const char *)&scannedOffset, sizeof(scannedOffset));
+        file.write((const char *)&startOffset, sizeof(startOffset));
+        file.write((const char *)&count, sizeof(count));
+        file.write((const char *)entries.data(), count * sizeof(Entry));
+    }
+
+    static const int Magic = 0x5844494c; // "LIDX"
+
+    int interval;
+    long long recordsIndexed;
+    long long lastLsn;
+    long long scannedOffset;
+    long long startOffset;
+    std::vector<Entry> entries;
+};
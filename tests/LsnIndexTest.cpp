@@ -0,0 +1,184 @@
+#pragma once
+
+#include "pch.h"
+#include "LsnIndex.h"
+
+#include <sstream>
+
+namespace {
+    // appends records with lsn [firstLsn, firstLsn + count) of varying payload size
+    void AppendRecords(std::ostream & log, LsnIndex * index, long long firstLsn, int count) {
+        for (long long lsn = firstLsn; lsn < firstLsn + count; ++lsn) {
+            RecordHeader header{ lsn, (int)(lsn % 100), 0 };
+            long long offset = log.tellp();
+            log.write((const char *)&header, sizeof(header));
+            log << std::string(header.size, (char)('a' + (lsn % 26)));
+            if (index != nullptr) {
+                index->Add(header, offset);
+            }
+        }
+    }
+}
+
+TEST(lsn_index, lookup_finds_closest_entry_before_lsn) {
+    LsnIndex index(10);
+    long long offset = 0;
+    for (long long lsn = 1; lsn <= 95; ++lsn) {
+        RecordHeader header{ lsn, 100, 0 };
+        index.Add(header, offset);
+        offset += sizeof(header) + header.size;
+    }
+    EXPECT_EQ(10, index.GetEntryCount());
+    EXPECT_EQ(95, index.GetLastLsn());
+    EXPECT_EQ(offset, index.GetScannedOffset());
+
+    LsnIndex::Entry entry;
+    EXPECT_FALSE(index.Lookup(0, entry));
+    EXPECT_FALSE(index.Lookup(96, entry));
+    EXPECT_TRUE(index.Lookup(1, entry));
+    EXPECT_EQ(1, entry.lsn);
+    EXPECT_TRUE(index.Lookup(20, entry));
+    EXPECT_EQ(11, entry.lsn);
+    EXPECT_EQ(10 * (long long)(sizeof(RecordHeader) + 100), entry.offset);
+    EXPECT_TRUE(index.Lookup(95, entry));
+    EXPECT_EQ(91, entry.lsn);
+
+    try {
+        index.Add(RecordHeader{ 95, 100, 0 }, offset);
+        EXPECT_TRUE(false) << "should throw";
+    }
+    catch (std::runtime_error &) {
+    }
+}
+
+TEST(lsn_index, seek_positions_at_record_payload) {
+    std::stringstream log;
+    LsnIndex index(8);
+    AppendRecords(log, &index, 1, 500);
+
+    for (long long lsn = 1; lsn <= 500; lsn += 7) {
+        RecordHeader header;
+        ASSERT_TRUE(index.Seek(log, lsn, header));
+        EXPECT_EQ(lsn, header.lsn);
+        std::string payload(header.size, 0);
+        log.read(&payload[0], header.size);
+        EXPECT_EQ(std::string(header.size, (char)('a' + (lsn % 26))), payload);
+    }
+
+    RecordHeader header;
+    EXPECT_FALSE(index.Seek(log, 501, header));
+}
+
+TEST(lsn_index, recover_continues_from_saved_index) {
+    std::stringstream log;
+    LsnIndex written(16);
+    AppendRecords(log, &written, 1, 300);
+
+    std::string filename = "index1.idx";
+    written.Save(filename);
+
+    // more records appended after the index was persisted, and a torn record at the end.
+    AppendRecords(log, nullptr, 301, 200);
+    RecordHeader torn{ 501, 4096, 0 };
+    log.write((const char *)&torn, sizeof(torn));
+
+    LsnIndex recovered = LsnIndex::Load(filename);
+    EXPECT_EQ(300, recovered.GetLastLsn());
+    recovered.Recover(log);
+    EXPECT_EQ(500, recovered.GetLastLsn());
+
+    LsnIndex scanned(16);
+    scanned.Recover(log);
+    EXPECT_EQ(500, scanned.GetLastLsn());
+    EXPECT_EQ(scanned.GetScannedOffset(), recovered.GetScannedOffset());
+    EXPECT_EQ(scanned.GetEntryCount(), recovered.GetEntryCount());
+
+    RecordHeader header;
+    EXPECT_TRUE(recovered.Seek(log, 450, header));
+    EXPECT_EQ(450, header.lsn);
+
+    std::remove(filename.c_str());
+}
+
+TEST(lsn_index, truncate_before_drops_older_entries) {
+    std::stringstream log;
+    LsnIndex index(10);
+    AppendRecords(log, &index, 1, 100);
+
+    LsnIndex::Entry entry;
+    ASSERT_TRUE(index.Lookup(35, entry));
+    EXPECT_EQ(entry.offset, index.TruncateBefore(35));
+    EXPECT_EQ(7, index.GetEntryCount());
+
+    EXPECT_FALSE(index.Lookup(30, entry));
+    RecordHeader header;
+    EXPECT_TRUE(index.Seek(log, 35, header));
+    EXPECT_TRUE(index.Seek(log, 31, header)); // still reachable from the kept entry
+    EXPECT_FALSE(index.Seek(log, 30, header));
+
+    EXPECT_EQ(-1, index.TruncateBefore(101));
+    EXPECT_EQ(-1, index.TruncateBefore(5));
+    EXPECT_EQ(7, index.GetEntryCount());
+}
+
+TEST(lsn_index, recover_stops_at_zeroed_region) {
+    // preallocated log: valid records followed by zeros.
+    std::stringstream preallocated;
+    AppendRecords(preallocated, nullptr, 1, 50);
+    long long valid_end = preallocated.tellp();
+    preallocated << std::string(16 * 1024, '\0');
+
+    LsnIndex index(8);
+    index.Recover(preallocated);
+    EXPECT_EQ(50, index.GetLastLsn());
+    EXPECT_EQ(valid_end, index.GetScannedOffset());
+
+    // zeroed prefix in front of valid records: nothing is indexed, and nothing throws.
+    std::stringstream zeroed;
+    zeroed << std::string(16 * 1024, '\0');
+    AppendRecords(zeroed, nullptr, 1, 50);
+
+    LsnIndex fresh(8);
+    fresh.Recover(zeroed);
+    EXPECT_EQ(0, fresh.GetLastLsn());
+    EXPECT_EQ(0, fresh.GetScannedOffset());
+    EXPECT_EQ(0, fresh.GetEntryCount());
+}
+
+TEST(lsn_index, recover_after_truncation) {
+    std::stringstream log;
+    LsnIndex index(10);
+    AppendRecords(log, &index, 1, 100);
+
+    // checkpoint: save the truncated index over the previous one, then deallocate the prefix (zeros, as a punched hole reads).
+    std::string filename = "index2.idx";
+    index.Save(filename);
+    long long start = index.TruncateBefore(35);
+    ASSERT_LT(0, start);
+    index.Save(filename);
+    EXPECT_FALSE(std::ifstream(filename + ".tmp")); // replaced the old index
+    std::string data = log.str();
+    data.replace(0, (size_t)start, std::string((size_t)start, '\0'));
+    std::stringstream truncated(data);
+    truncated.seekp(0, std::ios_base::end);
+    AppendRecords(truncated, nullptr, 101, 50);
+
+    LsnIndex recovered = LsnIndex::Load(filename);
+    EXPECT_EQ(start, recovered.GetStartOffset());
+    recovered.Recover(truncated);
+    EXPECT_EQ(150, recovered.GetLastLsn());
+
+    RecordHeader header;
+    EXPECT_TRUE(recovered.Seek(truncated, 35, header));
+    EXPECT_EQ(35, header.lsn);
+    EXPECT_TRUE(recovered.Seek(truncated, 140, header));
+    EXPECT_EQ(140, header.lsn);
+    EXPECT_FALSE(recovered.Seek(truncated, 20, header));
+
+    // without the saved index recovery stops at the hole rather than throwing.
+    LsnIndex fresh(10);
+    fresh.Recover(truncated);
+    EXPECT_EQ(0, fresh.GetLastLsn());
+
+    std::remove(filename.c_str());
+}
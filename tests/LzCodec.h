@@ -0,0 +1,231 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+/**
+* Header in front of every block written with compression on.
+* Each block is self contained, so a reader can skip `storedSize` bytes to the next block without decompressing.
+*/
+struct CompressedBlockHeader {
+    int rawSize;
+    int storedSize;
+    int compressed;   // 0 when block did not compress and is stored as is.
+    uint32_t checksum; // of raw data
+};
+
+static_assert(sizeof(CompressedBlockHeader) == 16, "CompressedBlockHeader is part of the on disk format");
+
+/**
+* Fast LZ77 codec in the LZ4 block format family: sequences of
+* [token: literal length << 4 | match length - 4][extra literal length bytes][literals][2 byte offset][extra match length bytes].
+* Lengths of 15 or more continue in following bytes, each adding up to 255. Last sequence has literals only.
+* Greedy matching through a single entry hash table and skipping ahead over unmatched input trade ratio for speed.
+*/
+class LzCodec {
+public:
+    static size_t MaxCompressedSize(size_t rawSize) {
+        return rawSize + (rawSize / 255) + 16;
+    }
+
+    LzCodec() : table(TableSize) {}
+
+    // Returns compressed size, or 0 if output would not fit in `dstCapacity`.
+    size_t Compress(const char * src, size_t srcSize, char * dst, size_t dstCapacity) {
+        std::fill(table.begin(), table.end(), -1);
+        const uint8_t * in = (const uint8_t *)src;
+        uint8_t * out = (uint8_t *)dst;
+        uint8_t * outEnd = out + dstCapacity;
+
+        size_t anchor = 0; // start of pending literals
+        size_t pos = 0;
+        // last match must leave room for the literals only sequence at the end.
+        size_t matchLimit = srcSize > LastLiterals ? srcSize - LastLiterals : 0;
+
+        size_t misses = 0;
+        while (pos + MinMatch <= matchLimit) {
+            uint32_t sequence = Read32(in + pos);
+            uint32_t hash = (sequence * 2654435761U) >> (32 - TableBits);
+            int candidate = table[hash];
+            table[hash] = (int)pos;
+
+            if (candidate < 0 || pos - candidate > MaxOffset || Read32(in + candidate) != sequence) {
+                // step further the longer nothing matches, so incompressible data is skipped quickly.
+                pos += 1 + (misses++ >> SkipShift);
+                continue;
+            }
+            misses = 0;
+
+            size_t matchLength = MinMatch;
+            while (pos + matchLength + 8 <= matchLimit && Read64(in + candidate + matchLength) == Read64(in + pos + matchLength)) {
+                matchLength += 8;
+            }
+            while (pos + matchLength < matchLimit && in[candidate + matchLength] == in[pos + matchLength]) {
+                ++matchLength;
+            }
+
+            out = WriteSequence(out, outEnd, in + anchor, pos - anchor, (int)(pos - candidate), matchLength);
+            if (out == nullptr) {
+                return 0;
+            }
+
+            pos += matchLength;
+            anchor = pos;
+        }
+
+        out = WriteSequence(out, outEnd, in + anchor, srcSize - anchor, 0, 0);
+        if (out == nullptr) {
+            return 0;
+        }
+
+        return out - (uint8_t *)dst;
+    }
+
+    // Returns decompressed size; throws on malformed input or if output does not fit in `dstCapacity`.
+    static size_t Decompress(const char * src, size_t srcSize, char * dst, size_t dstCapacity) {
+        const uint8_t * in = (const uint8_t *)src;
+        const uint8_t * inEnd = in + srcSize;
+        uint8_t * out = (uint8_t *)dst;
+        uint8_t * outEnd = out + dstCapacity;
+
+        while (in < inEnd) {
+            uint8_t token = *in++;
+
+            size_t literalLength = ReadLength(in, inEnd, token >> 4);
+            if ((size_t)(inEnd - in) < literalLength || (size_t)(outEnd - out) < literalLength) {
+                throw std::runtime_error("malformed compressed block");
+            }
+            memcpy(out, in, literalLength);
+            in += literalLength;
+            out += literalLength;
+
+            if (in == inEnd) {
+                break; // last sequence
+            }
+
+            if (inEnd - in < 2) {
+                throw std::runtime_error("malformed compressed block");
+            }
+            size_t offset = in[0] | (in[1] << 8);
+            in += 2;
+            size_t matchLength = ReadLength(in, inEnd, token & 0xf) + MinMatch;
+            if (offset == 0 || offset > (size_t)(out - (uint8_t *)dst) || (size_t)(outEnd - out) < matchLength) {
+                throw std::runtime_error("malformed compressed block");
+            }
+
+            // byte by byte since match may overlap the bytes it produces.
+            const uint8_t * match = out - offset;
+            for (size_t i = 0; i < matchLength; ++i) {
+                out[i] = match[i];
+            }
+            out += matchLength;
+        }
+
+        return out - (uint8_t *)dst;
+    }
+
+    // FNV-1a
+    static uint32_t Checksum(const char * data, size_t size) {
+        uint32_t hash = 2166136261U;
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ (uint8_t)data[i]) * 16777619U;
+        }
+        return hash;
+    }
+
+private:
+    static const int TableBits = 14;
+    static const size_t TableSize = 1 << TableBits;
+    static const size_t MinMatch = 4;
+    static const size_t MaxOffset = 65535;
+    static const size_t LastLiterals = 8;
+    static const int SkipShift = 6;
+
+    static uint32_t Read32(const uint8_t * p) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint64_t Read64(const uint8_t * p) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint8_t * WriteLength(uint8_t * out, uint8_t * outEnd, size_t length) {
+        while (length >= 255) {
+            if (out == outEnd) {
+                return nullptr;
+            }
+            *out++ = 255;
+            length -= 255;
+        }
+
+        if (out == outEnd) {
+            return nullptr;
+        }
+        *out++ = (uint8_t)length;
+        return out;
+    }
+
+    static size_t ReadLength(const uint8_t *& in, const uint8_t * inEnd, size_t length) {
+        if (length != 15) {
+            return length;
+        }
+
+        uint8_t b;
+        do {
+            if (in == inEnd) {
+                throw std::runtime_error("malformed compressed block");
+            }
+            b = *in++;
+            length += b;
+        } while (b == 255);
+
+        return length;
+    }
+
+    // matchLength of 0 writes the final, literals only, sequence.
+    static uint8_t * WriteSequence(uint8_t * out, uint8_t * outEnd, const uint8_t * literals, size_t literalLength,
+        int offset, size_t matchLength) {
+        if (out == outEnd) {
+            return nullptr;
+        }
+
+        size_t matchCode = matchLength == 0 ? 0 : matchLength - MinMatch;
+        uint8_t * token = out++;
+        *token = (uint8_t)(((literalLength >= 15 ? 15 : literalLength) << 4) | (matchCode >= 15 ? 15 : matchCode));
+
+        if (literalLength >= 15 && (out = WriteLength(out, outEnd, literalLength - 15)) == nullptr) {
+            return nullptr;
+        }
+
+        if ((size_t)(outEnd - out) < literalLength) {
+            return nullptr;
+        }
+        memcpy(out, literals, literalLength);
+        out += literalLength;
+
+        if (matchLength == 0) {
+            return out;
+        }
+
+        if (outEnd - out < 2) {
+            return nullptr;
+        }
+        *out++ = (uint8_t)(offset & 0xff);
+        *out++ = (uint8_t)(offset >> 8);
+
+        if (matchCode >= 15 && (out = WriteLength(out, outEnd, matchCode - 15)) == nullptr) {
+            return nullptr;
+        }
+
+        return out;
+    }
+
+    std::vector<int> table;
+};
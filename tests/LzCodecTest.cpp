@@ -0,0 +1,88 @@
+#pragma once
+
+#include "pch.h"
+#include "LzCodec.h"
+
+#include <string>
+
+namespace {
+    std::string RoundTrip(LzCodec & codec, const std::string & raw, size_t & compressedSize) {
+        std::vector<char> compressed(LzCodec::MaxCompressedSize(raw.size()));
+        compressedSize = codec.Compress(raw.data(), raw.size(), compressed.data(), compressed.size());
+        EXPECT_NE(0, compressedSize);
+
+        std::string decompressed(raw.size(), 0);
+        size_t size = LzCodec::Decompress(compressed.data(), compressedSize, &decompressed[0], decompressed.size());
+        EXPECT_EQ(raw.size(), size);
+        return decompressed;
+    }
+}
+
+TEST(lz_codec, round_trips_all_kinds_of_data) {
+    int seed = (int)time(nullptr);
+    std::cout << "Random seed: " << seed << std::endl;
+    std::srand(seed);
+
+    LzCodec codec;
+    std::vector<std::string> inputs{ "", "a", "abcd", std::string(1000, 'x'), std::string(70000, 'y') };
+    for (int size = 1; size < 40; ++size) {
+        inputs.push_back(std::string(size, 'z'));
+    }
+
+    std::string text;
+    for (int i = 0; i < 2000; ++i) {
+        text += "lsn=" + std::to_string(i) + " op=UPDATE table=orders key=" + std::to_string(std::rand() % 1000) + "\n";
+    }
+    inputs.push_back(text);
+
+    std::string random(100000, 0);
+    for (auto & c : random) {
+        c = (char)std::rand();
+    }
+    inputs.push_back(random);
+
+    for (auto & raw : inputs) {
+        size_t compressedSize = 0;
+        EXPECT_EQ(raw, RoundTrip(codec, raw, compressedSize)) << "size " << raw.size();
+    }
+
+    size_t compressedSize = 0;
+    RoundTrip(codec, std::string(70000, 'y'), compressedSize);
+    EXPECT_GT(1000, compressedSize);
+    RoundTrip(codec, text, compressedSize);
+    EXPECT_GT(text.size() / 2, compressedSize);
+}
+
+TEST(lz_codec, reports_output_that_does_not_fit) {
+    LzCodec codec;
+    std::string random(4096, 0);
+    for (auto & c : random) {
+        c = (char)std::rand();
+    }
+
+    std::vector<char> compressed(random.size());
+    EXPECT_EQ(0, codec.Compress(random.data(), random.size(), compressed.data(), compressed.size() / 2));
+}
+
+TEST(lz_codec, rejects_malformed_input) {
+    std::string raw(1000, 'q');
+    LzCodec codec;
+    std::vector<char> compressed(LzCodec::MaxCompressedSize(raw.size()));
+    size_t size = codec.Compress(raw.data(), raw.size(), compressed.data(), compressed.size());
+
+    std::vector<char> out(raw.size());
+    try {
+        LzCodec::Decompress(compressed.data(), size, out.data(), out.size() / 2);
+        EXPECT_TRUE(false) << "should throw";
+    }
+    catch (std::runtime_error &) {
+    }
+
+    const char badOffset[]{ 0x10, 'a', 0x05, 0x00 };
+    try {
+        LzCodec::Decompress(badOffset, sizeof(badOffset), out.data(), out.size());
+        EXPECT_TRUE(false) << "should throw";
+    }
+    catch (std::runtime_error &) {
+    }
+}
@@ -47,6 +47,24 @@ public:
         return MetricRecorderIterator(*this);
     }
 
+    // All slots filled, so buckets can be read.
+    bool IsFull() const {
+        return !CheckSpace(true);
+    }
+
+    int GetBucketCount() const {
+        return (int)buckets.size();
+    }
+
+    // Bulk access to filled slots of a bucket, for merging without going through the iterator per value.
+    const int * GetBucket(int bucketIndex, int & count) const {
+        if (CheckSpace(true)) { // should not have any space left - writes should finish.
+            throw std::runtime_error("Buckets can only be read after filling all slots.");
+        }
+        count = (bucketIndex == (int)buckets.size() - 1) ? lastBucketSize : (int)buckets[bucketIndex].size();
+        return buckets[bucketIndex].data();
+    }
+
     class MetricRecorderIterator {
     public:
         MetricRecorderIterator(const MetricRecorder & list) : list(list), index(0) { }
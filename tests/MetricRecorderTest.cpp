@@ -31,4 +31,35 @@ TEST(metric_recorder, can_add_get_values) {
             expected += 1;
         }
     }
-}
\ No newline at end of file
+}
+
+TEST(metric_recorder, bucket_access_matches_iterator) {
+    int size = 2500;
+    MetricRecorder m(size, 1024);
+    for (int i = 0; i < size; ++i) {
+        m.Add(i);
+    }
+
+    EXPECT_EQ(3, m.GetBucketCount());
+    int expected = 0;
+    for (int b = 0; b < m.GetBucketCount(); ++b) {
+        int count = 0;
+        const int * values = m.GetBucket(b, count);
+        EXPECT_EQ(b == 2 ? 452 : 1024, count);
+        for (int i = 0; i < count; ++i) {
+            EXPECT_EQ(expected, values[i]);
+            expected += 1;
+        }
+    }
+    EXPECT_EQ(size, expected);
+
+    MetricRecorder partial(10);
+    partial.Add(1);
+    int count = 0;
+    try {
+        partial.GetBucket(0, count);
+        EXPECT_TRUE(false) << "should throw";
+    }
+    catch (std::runtime_error &) {
+    }
+}
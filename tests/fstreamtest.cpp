@@ -6,13 +6,30 @@
 #include <fstream>
 #include <vector>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <random>
+#include <map>
+#include <memory>
 
 #include "MetricRecorder.h"
 #include "Histogram.h"
+#include "HistogramSnapshot.h"
+#include "LogTailer.h"
+#include "GatherWriter.h"
+#include "BufferArena.h"
+#include "LsnIndex.h"
+#include "LzCodec.h"
+#include "FlushPolicy.h"
 
 using namespace std;
 
 namespace fs = experimental::filesystem;
+
+// all writer and verification buffers come from here, so the write path does not allocate.
+static BufferArena buffer_arena;
+
 TEST(fstream, seekg_seekp_same)
 {
     std::string filename = "file1.log";
@@ -105,11 +122,19 @@ TEST(fstream, read_write_with_same_fstream)
     std::remove(filename.c_str());
 }
 
-void PrintHistogram(std::vector<MetricRecorder> recorders) {
-    Histogram hgm(recorders);
-    std::vector<double> pAt{ .5, .75, .9, .99, .995, .999 };
-    auto ps = hgm.GetPercentiles(pAt);
-    hgm.Print(pAt, ps);
+const std::vector<double> ReportedPercentiles{ .5, .75, .9, .99, .995, .999 };
+
+// With LOGPOC_SNAPSHOT_DIR set, histograms of named scenarios are also saved there to compare runs later.
+void PrintHistogram(std::vector<MetricRecorder> recorders, const std::string & scenario = "",
+    const HistogramSnapshot::Parameters & parameters = {}) {
+    auto snapshot = HistogramSnapshot::FromRecorders(scenario, parameters, recorders);
+    auto ps = snapshot.GetPercentiles(ReportedPercentiles);
+    Histogram(recorders).Print(ReportedPercentiles, ps);
+
+    const char * snapshot_dir = getenv("LOGPOC_SNAPSHOT_DIR");
+    if (snapshot_dir != nullptr && !scenario.empty()) {
+        std::cout << "Snapshot: " << snapshot.SaveRun(snapshot_dir) << std::endl;
+    }
 }
 
 void write_concurrently(string filename, const int data_in_gb, const int num_threads, const char start_char,
@@ -133,7 +158,9 @@ void write_concurrently(string filename, const int data_in_gb, const int num_thr
 
             file_handle.seekp(0, ios_base::beg);
 
-            vector<char> data(offset, (char) (index + start_char));
+            BufferArena::ThreadCache cache(buffer_arena);
+            auto data = cache.Acquire(offset);
+            std::fill(data.begin(), data.end(), (char) (index + start_char));
             long long myoffset = index * offset;
             auto clock = std::chrono::high_resolution_clock();
 
@@ -142,7 +169,7 @@ void write_concurrently(string filename, const int data_in_gb, const int num_thr
                 auto start_time = clock.now();
 
                 file_handle.seekp(myoffset, ios_base::beg);
-                file_handle.write(data.data(), offset);
+                file_handle.write(data.Data(), offset);
                 myoffset += num_threads * offset;
                 
                 auto end_time = clock.now();
@@ -166,7 +193,8 @@ void write_concurrently(string filename, const int data_in_gb, const int num_thr
 
         std::cout << "Data written : " << data_in_gb << " GB, " << num_threads << " threads "
                   << ", cache " << (stream_cache ? "true " : "false ") << ", size " << offset << " bytes ";
-        std::cout << "Time taken: " << (end_time - start_time).count() / 1000 << " micro-secs" << std::endl;
+        std::cout << "Time taken: " << (end_time - start_time).count() / 1000 << " micro-secs"
+                  << ", arena misses " << buffer_arena.GetMisses() << std::endl;
     }
 
     {
@@ -176,10 +204,11 @@ void write_concurrently(string filename, const int data_in_gb, const int num_thr
         file.seekg(0, ios_base::beg);
         EXPECT_TRUE(file);
 
-        char data[offset]{0};
+        BufferArena::ThreadCache cache(buffer_arena);
+        auto data = cache.Acquire(offset);
         for (long long i = 0; i < (num_records_each_thread * num_threads); ++i)
         {
-            file.read(data, offset);
+            file.read(data.Data(), offset);
             EXPECT_TRUE(file || file.eof());// should be able to read until eof
             char expected_char = (char) ((i % num_threads) + start_char);
 
@@ -205,7 +234,8 @@ void write_concurrently(string filename, const int data_in_gb, const int num_thr
     }
 
     // Print histogram
-    PrintHistogram(recorders);
+    PrintHistogram(recorders, "write_concurrently", { { "file", filename }, { "start", string(1, start_char) },
+        { "gb", to_string(data_in_gb) }, { "threads", to_string(num_threads) }, { "cache", stream_cache ? "true" : "false" } });
 }
 // analysis: Possible but multiple thread is slower because of exlsuive locking in filesystem : ExAcquireResourceExclusiveLite
 //Name                                                        	Inc %	     Inc	Exc %	   Exc	Fold	                             When	  First	       Last
@@ -280,8 +310,10 @@ TEST(fstream, preallocated_file_concurrent_writes_stream_cache)
     std::remove(filename.c_str());
 }
 
+// Records commit latency: from the start of an append until the flush and sync of its group completes.
+// A flusher thread commits groups which reach the policy's deadline while no append comes to check it.
 void append_concurrently(string filename, const int data_in_gb, const int num_threads, const char start_char,
-    bool stream_cache = true, bool flush = false) {
+    bool stream_cache = true, FlushController flush_policy = FlushController::Never()) {
     const int offset = 4 * 1024;
     const int num_records_each_thread = (data_in_gb * 1024 * ((1024 * 1024) / (num_threads * offset)));
     std::vector<MetricRecorder> recorders;
@@ -296,32 +328,89 @@ void append_concurrently(string filename, const int data_in_gb, const int num_th
         if (!stream_cache) {
             file_handle.rdbuf()->pubsetbuf(nullptr, 0); // no bufferring in fstream
         }
+        FileSync sync(filename);
+
+        // writers share the handle, the flush policy, the unflushed group and the recorders under one lock.
+        std::mutex file_mutex;
+        std::condition_variable pending_cv; // signalled when a group starts or writers are done
+        bool writers_done = false;
+        long long pending_bytes = 0;
+        vector<std::pair<int, chrono::high_resolution_clock::time_point>> pending_starts; // writer index, append start
+        auto oldest_pending = chrono::high_resolution_clock::now();
+        long long num_flushes = 0;
+        bool has_deadline = flush_policy.FlushDeadline(oldest_pending) != FlushController::Clock::time_point::max();
+
+        // called with file_mutex held.
+        auto flush_group = [&]() {
+            file_handle.flush();
+            sync.Sync();
+            auto end_time = chrono::high_resolution_clock::now();
+            for (auto & pending : pending_starts) {
+                int latency = (int)std::chrono::duration_cast<std::chrono::microseconds>(end_time - pending.second).count();
+                flush_policy.OnCommit(latency);
+                recorders[pending.first].Add(latency);
+            }
+            pending_starts.clear();
+            pending_bytes = 0;
+            num_flushes += 1;
+        };
+
+        auto flusher_fn = [&]() {
+            std::unique_lock<std::mutex> lock(file_mutex);
+            while (!writers_done) {
+                if (pending_bytes == 0) {
+                    pending_cv.wait(lock);
+                    continue;
+                }
+
+                auto deadline = flush_policy.FlushDeadline(oldest_pending);
+                if (FlushController::Clock::now() < deadline) {
+                    pending_cv.wait_until(lock, deadline);
+                    continue;
+                }
+
+                flush_group();
+            }
+        };
 
         {
             auto write_file_fn = [&](int index) {
-                vector<char> data(offset, (char)(index + start_char));
-                MetricRecorder & recorder = recorders[index];
+                BufferArena::ThreadCache cache(buffer_arena);
+                auto data = cache.Acquire(offset);
+                std::fill(data.begin(), data.end(), (char)(index + start_char));
                 auto clock = std::chrono::high_resolution_clock();
 
                 for (long long i = 0; i < num_records_each_thread; ++i) {
                     auto start_time = clock.now();
-                    file_handle.write(data.data(), offset);
+                    std::lock_guard<std::mutex> lock(file_mutex);
+                    file_handle.write(data.Data(), offset);
                     if (!file_handle) {
                         std::cout << "File write failed: "
                             << file_handle.fail() << " " << file_handle.bad() << " " << file_handle.eof() << std::endl;
                         break;
                     }
 
-                    if (flush) {
-                        file_handle.flush();
+                    if (pending_starts.empty()) {
+                        oldest_pending = start_time;
+                        if (has_deadline) {
+                            pending_cv.notify_one();
+                        }
                     }
+                    pending_starts.push_back({ index, start_time });
+                    pending_bytes += offset;
 
-                    auto end_time = clock.now();
-                    recorder.Add((int)std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time).count());
+                    if (flush_policy.ShouldFlush(pending_bytes, oldest_pending, clock.now())) {
+                        flush_group();
+                    }
                 }
             };
 
             auto start_time = chrono::high_resolution_clock::now();
+            thread flusher_thread;
+            if (has_deadline) {
+                flusher_thread = thread(flusher_fn);
+            }
+
             vector<thread> writer_threads;
             for (int i = 0; i < num_threads; ++i) {
                 writer_threads.push_back(std::thread(write_file_fn, i));
@@ -331,12 +420,26 @@ void append_concurrently(string filename, const int data_in_gb, const int num_th
                 writer_threads[i].join();
             }
 
+            if (flusher_thread.joinable()) {
+                {
+                    std::lock_guard<std::mutex> lock(file_mutex);
+                    writers_done = true;
+                }
+                pending_cv.notify_one();
+                flusher_thread.join();
+            }
+
+            // the rest commits as one group, whatever the policy.
+            if (!pending_starts.empty()) {
+                flush_group();
+            }
             auto end_time = chrono::high_resolution_clock::now();
 
             std::cout << filename << " Data written : " << data_in_gb << " GB, " << num_threads << " threads "
                 << ", cache " << (stream_cache ? "true " : "false ") << ", size " << offset << " bytes "
-                << ", flush " << (flush ? "true " : "false ");
-            std::cout << "Time taken: " << (end_time - start_time).count() / 1000 << " micro-secs" << std::endl;
+                << ", flush " << flush_policy.GetModeName() << " ";
+            std::cout << "Time taken: " << (end_time - start_time).count() / 1000 << " micro-secs"
+                << ", flushes " << num_flushes << ", arena misses " << buffer_arena.GetMisses() << std::endl;
         }
     }
 
@@ -348,11 +451,12 @@ void append_concurrently(string filename, const int data_in_gb, const int num_th
         file.seekg(0, ios_base::beg);
         EXPECT_TRUE(file);
 
-        char data[offset]{ 0 };
+        BufferArena::ThreadCache cache(buffer_arena);
+        auto data = cache.Acquire(offset);
         for (long long i = 0; i < (num_records_each_thread * num_threads); ++i) {
-            file.read(data, offset);
+            file.read(data.Data(), offset);
             EXPECT_TRUE(file || file.eof()); // should be able to read until eof
-            char expected_char = data[0]; // should not have any interleaving of data.
+            char expected_char = data.Data()[0]; // should not have any interleaving of data.
 
             bool same = true;
             for (auto & c : data) {
@@ -373,7 +477,8 @@ void append_concurrently(string filename, const int data_in_gb, const int num_th
     }
 
     // print the latency histogram
-    PrintHistogram(recorders);
+    PrintHistogram(recorders, "append_concurrently", { { "file", filename }, { "gb", to_string(data_in_gb) },
+        { "threads", to_string(num_threads) }, { "cache", stream_cache ? "true" : "false" }, { "flush", flush_policy.GetModeName() } });
 }
 
 // Preallocated file + no stream cache
@@ -385,7 +490,7 @@ TEST(fstream, file_concurrent_appends) {
         {
             fstream file(filename, fstream::in | fstream::out | fstream::trunc | fstream::binary);
         }
-        append_concurrently(filename, data_in_gb, 1, 'A', true, true);
+        append_concurrently(filename, data_in_gb, 1, 'A', true, FlushController::EveryRecord());
     }
 
     {
@@ -393,7 +498,31 @@ TEST(fstream, file_concurrent_appends) {
         {
             fstream file(filename, fstream::in | fstream::out | fstream::trunc | fstream::binary);
         }
-        append_concurrently(filename, data_in_gb, 1, 'A', true, false);
+        append_concurrently(filename, data_in_gb, 1, 'A', true, FlushController::Never());
+    }
+
+    {
+        // trunc file before write threads start.
+        {
+            fstream file(filename, fstream::in | fstream::out | fstream::trunc | fstream::binary);
+        }
+        append_concurrently(filename, data_in_gb, 1, 'A', true, FlushController::FixedBytes(1024 * 1024));
+    }
+
+    {
+        // trunc file before write threads start.
+        {
+            fstream file(filename, fstream::in | fstream::out | fstream::trunc | fstream::binary);
+        }
+        append_concurrently(filename, data_in_gb, 1, 'A', true, FlushController::FixedInterval(1000));
+    }
+
+    {
+        // trunc file before write threads start.
+        {
+            fstream file(filename, fstream::in | fstream::out | fstream::trunc | fstream::binary);
+        }
+        append_concurrently(filename, data_in_gb, 4, 'A', true, FlushController::LatencyTarget(1000));
     }
 
     //{
@@ -405,4 +534,685 @@ TEST(fstream, file_concurrent_appends) {
     //}
 
     std::remove(filename.c_str());
-}
\ No newline at end of file
+}
+
+// Writer appends, syncs and publishes durable offset after every `flush_every` records,
+// while a tail reader follows the log as a replica would.
+void append_with_tail_reader(string filename, const int data_in_gb, const int flush_every, const char start_char) {
+    const int offset = 4 * 1024;
+    const int num_records = (data_in_gb * 1024 * ((1024 * 1024) / offset));
+    MetricRecorder write_recorder(num_records);
+    MetricRecorder propagation_recorder(num_records); // publish of durable offset => record read by tailer
+    DurableOffset durable;
+    long long stale_reads = 0;
+
+    auto tail_fn = [&]() {
+        LogTailReader tailer(filename, durable);
+        BufferArena::ThreadCache cache(buffer_arena);
+        auto data = cache.Acquire(offset);
+        std::chrono::high_resolution_clock::time_point published_at;
+        long long i = 0;
+        // durable offset always moves by whole records, so each read returns exactly one record.
+        while (tailer.ReadNext(data.Data(), offset, published_at) != 0) {
+            auto read_time = std::chrono::high_resolution_clock::now();
+            propagation_recorder.Add((int)std::chrono::duration_cast<std::chrono::microseconds>(read_time - published_at).count());
+
+            char expected_char = (char)((i % 26) + start_char);
+            bool same = true;
+            for (auto & c : data) {
+                same = same && (c == expected_char);
+            }
+
+            EXPECT_TRUE(same);
+            if (!same) {
+                std::cout << "corruption detected in tail !!!" << std::endl;
+                break;
+            }
+            ++i;
+        }
+
+        EXPECT_EQ(num_records, i);
+        stale_reads = tailer.GetStaleReads();
+    };
+
+    auto start_time = chrono::high_resolution_clock::now();
+    thread tail_thread(tail_fn);
+    {
+        fstream file_handle(filename, fstream::app | fstream::binary);
+        FileSync sync(filename);
+        BufferArena::ThreadCache cache(buffer_arena);
+        auto data = cache.Acquire(offset);
+        long long written = 0;
+        auto clock = std::chrono::high_resolution_clock();
+
+        for (long long i = 0; i < num_records; ++i) {
+            std::fill(data.begin(), data.end(), (char)((i % 26) + start_char));
+
+            auto start_time = clock.now();
+            file_handle.write(data.Data(), offset);
+            written += offset;
+            if (((i + 1) % flush_every) == 0 || (i + 1) == num_records) {
+                file_handle.flush();
+                sync.Sync();
+                durable.Publish(written);
+            }
+
+            auto end_time = clock.now();
+            write_recorder.Add((int)std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time).count());
+        }
+    }
+    durable.Close();
+    tail_thread.join();
+    auto end_time = chrono::high_resolution_clock::now();
+
+    std::cout << filename << " Data written : " << data_in_gb << " GB, 1 threads, size " << offset << " bytes "
+        << ", flush every " << flush_every << " records ";
+    std::cout << "Time taken: " << (end_time - start_time).count() / 1000 << " micro-secs" << std::endl;
+
+    std::cout << "Write latency:" << std::endl;
+    PrintHistogram(std::vector<MetricRecorder>{ write_recorder }, "tail_write", { { "flush_every", to_string(flush_every) } });
+    std::cout << "Writer to tail reader propagation latency";
+    if (stale_reads != 0) {
+        std::cout << " (understated: " << stale_reads << " records read after their publish left the history)";
+    }
+    std::cout << ":" << std::endl;
+    PrintHistogram(std::vector<MetricRecorder>{ propagation_recorder }, "tail_propagation", { { "flush_every", to_string(flush_every) } });
+}
+
+TEST(fstream, append_with_tail_reader) {
+    string filename = "file7.log";
+    const int data_in_gb = 1;
+    for (int flush_every : {1, 16}) {
+        {
+            fstream file(filename, fstream::in | fstream::out | fstream::trunc | fstream::binary);
+        }
+        append_with_tail_reader(filename, data_in_gb, flush_every, 'A');
+    }
+
+    std::remove(filename.c_str());
+}
+
+
+// Each writer owns its record headers and payloads and commits them in batches of `records_per_batch`.
+// With `gather` the batch is submitted as fragments pointing at caller memory and written with one vectored write,
+// otherwise every record is first copied into a contiguous staging buffer as a WAL usually does and written with one write.
+// With `pad_headers` every header takes a whole page of its own, so that WriteFileGather, which only takes
+// page aligned pages, accepts every fragment; the padding is reported as overhead.
+void append_records_concurrently(string filename, const int data_in_gb, const int num_threads, const char start_char,
+    bool gather, const int records_per_batch, bool pad_headers = false) {
+    const int offset = 4 * 1024;
+    const int header_size = pad_headers ? (int)GatherFile::PageSize : (int)sizeof(RecordHeader);
+    const int record_size = header_size + offset;
+    const int num_batches_each_thread = (data_in_gb * 1024 * ((1024 * 1024) / (num_threads * offset))) / records_per_batch;
+    const long long num_records = (long long)num_batches_each_thread * records_per_batch * num_threads;
+    if (pad_headers && !gather) {
+        throw std::runtime_error("padded headers are only for gather writes");
+    }
+    if (!gather && (long long)records_per_batch * record_size > (long long)BufferArena::MaxBlockSize) {
+        throw std::runtime_error("batch does not fit in one staging buffer");
+    }
+    if (pad_headers && (long long)records_per_batch * header_size > (long long)BufferArena::MaxBlockSize) {
+        throw std::runtime_error("batch headers do not fit in one header buffer");
+    }
+
+    std::vector<MetricRecorder> recorders;
+    for (int i = 0; i < num_threads; ++i) {
+        recorders.push_back(MetricRecorder(num_batches_each_thread));
+    }
+
+    std::atomic<long long> bytes_copied(0);
+    long long bytes_written = 0;
+    {
+        fstream file_handle(filename, fstream::app | fstream::binary);
+        file_handle.rdbuf()->pubsetbuf(nullptr, 0); // no bufferring in fstream, so the only copies are ours.
+        std::unique_ptr<GatherFile> gather_file(gather ? new GatherFile(filename) : nullptr);
+        std::mutex file_mutex;
+        long long next_lsn = 1;
+        GatherWriter::Sink gather_sink = gather ? gather_file->Sink() : GatherWriter::Sink();
+
+        auto write_file_fn = [&](int index) {
+            MetricRecorder & recorder = recorders[index];
+            BufferArena::ThreadCache cache(buffer_arena);
+            auto payload = cache.Acquire(offset);
+            std::fill(payload.begin(), payload.end(), (char)(index + start_char));
+            vector<RecordHeader> headers(records_per_batch, RecordHeader{ 0, offset, 0 });
+            std::unique_ptr<BufferArena::Block> staging(gather ? nullptr
+                : new BufferArena::Block(cache.Acquire(records_per_batch * record_size)));
+            std::unique_ptr<BufferArena::Block> header_pages(pad_headers
+                ? new BufferArena::Block(cache.Acquire(records_per_batch * header_size)) : nullptr);
+            if (pad_headers) {
+                std::fill(header_pages->begin(), header_pages->end(), 0);
+            }
+            GatherWriter writer(gather_sink);
+            long long my_bytes_copied = 0;
+            auto clock = std::chrono::high_resolution_clock();
+
+            for (int b = 0; b < num_batches_each_thread; ++b) {
+                auto start_time = clock.now();
+                {
+                    std::lock_guard<std::mutex> lock(file_mutex);
+                    for (auto & header : headers) {
+                        header.lsn = next_lsn++;
+                    }
+
+                    if (pad_headers) {
+                        for (int r = 0; r < records_per_batch; ++r) {
+                            char * page = header_pages->Data() + (size_t)r * header_size;
+                            memcpy(page, &headers[r], sizeof(RecordHeader));
+                            Fragment fragments[]{ { page, (size_t)header_size }, { payload.Data(), (size_t)offset } };
+                            writer.Submit(fragments, 2);
+                        }
+                        writer.Flush();
+                    }
+                    else if (gather) {
+                        for (auto & header : headers) {
+                            writer.SubmitRecord(header, payload.Data());
+                        }
+                        writer.Flush();
+                    }
+                    else {
+                        char * pos = staging->Data();
+                        for (auto & header : headers) {
+                            memcpy(pos, &header, sizeof(header));
+                            memcpy(pos + sizeof(header), payload.Data(), offset);
+                            pos += record_size;
+                        }
+                        my_bytes_copied += staging->Size();
+                        file_handle.write(staging->Data(), staging->Size());
+                    }
+                }
+
+                auto end_time = clock.now();
+                recorder.Add((int)std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time).count());
+            }
+
+            bytes_copied += my_bytes_copied;
+        };
+
+        auto start_time = chrono::high_resolution_clock::now();
+        vector<thread> writer_threads;
+        for (int i = 0; i < num_threads; ++i) {
+            writer_threads.push_back(std::thread(write_file_fn, i));
+        }
+
+        for (int i = 0; i < num_threads; ++i) {
+            writer_threads[i].join();
+        }
+
+        auto end_time = chrono::high_resolution_clock::now();
+        bytes_written = num_records * record_size;
+
+        std::cout << filename << " Data written : " << data_in_gb << " GB, " << num_threads << " threads "
+            << ", size " << record_size << " bytes " << ", batch " << records_per_batch << " records "
+            << ", gather " << (gather ? "true " : "false ") << ", padded headers " << (pad_headers ? "true " : "false ");
+        std::cout << "Time taken: " << (end_time - start_time).count() / 1000 << " micro-secs"
+            << ", bytes copied per byte written: " << ((double)bytes_copied / bytes_written)
+            << ", padding per byte written: " << ((double)(header_size - sizeof(RecordHeader)) / record_size);
+        if (gather) {
+            std::cout << ", write calls per batch: "
+                << ((double)gather_file->GetWriteCalls() / ((long long)num_batches_each_thread * num_threads));
+        }
+        std::cout << std::endl;
+    }
+
+    // read back: headers must be in lsn order and payloads must not interleave.
+    {
+        ifstream file(filename, fstream::in | fstream::binary);
+        file.seekg(0, ios_base::end);
+        EXPECT_EQ(bytes_written, file.tellg());
+        file.seekg(0, ios_base::beg);
+
+        BufferArena::ThreadCache cache(buffer_arena);
+        auto data = cache.Acquire(offset);
+        for (long long i = 0; i < num_records; ++i) {
+            RecordHeader header;
+            file.read((char *)&header, sizeof(header));
+            file.seekg(header_size - sizeof(header), ios_base::cur);
+            file.read(data.Data(), offset);
+            EXPECT_TRUE(file);
+
+            bool same = (header.lsn == i + 1) && (header.size == offset);
+            for (auto & c : data) {
+                same = same && (c == data.Data()[0]) && (c != 0);
+            }
+
+            EXPECT_TRUE(same);
+            if (!same) {
+                std::cout << "corruption detected !!!" << std::endl;
+                break;
+            }
+        }
+    }
+
+    // print the batch commit latency histogram
+    PrintHistogram(recorders, "append_records", { { "gb", to_string(data_in_gb) }, { "threads", to_string(num_threads) },
+        { "gather", gather ? "true" : "false" }, { "batch", to_string(records_per_batch) },
+        { "padded", pad_headers ? "true" : "false" } });
+}
+
+TEST(fstream, append_records_gather_vs_copy) {
+    string filename = "file8.log";
+    const int data_in_gb = 2;
+    for (int num_threads : {1, 4}) {
+        // copy, gather of 16 byte headers, gather of page padded headers.
+        for (int mode : {0, 1, 2}) {
+            bool gather = mode != 0;
+            bool pad_headers = mode == 2;
+            if (gather && !pad_headers && !GatherFile::AcceptsAnyFragments) {
+                // 16 byte record headers are not whole pages, which WriteFileGather needs.
+                std::cout << "gather of unpadded headers: skipped, WriteFileGather takes whole pages only" << std::endl;
+                continue;
+            }
+            {
+                fstream file(filename, fstream::in | fstream::out | fstream::trunc | fstream::binary);
+            }
+            append_records_concurrently(filename, data_in_gb, num_threads, 'A', gather, 64, pad_headers);
+        }
+    }
+
+    std::remove(filename.c_str());
+}
+
+
+// Finds record `lsn` by walking headers from the start of the log, as recovery without an index has to.
+bool scan_to_record(istream & file, long long lsn, RecordHeader & header) {
+    file.clear();
+    file.seekg(0, ios_base::beg);
+    while (file.read((char *)&header, sizeof(header))) {
+        if (header.lsn == lsn) {
+            return true;
+        }
+        file.seekg(header.size, ios_base::cur);
+    }
+    return false;
+}
+
+// Writes `num_records` records while maintaining a sparse index, then compares random point lookups
+// through the persisted index against a linear scan.
+void lookup_records(string filename, const int num_records, const int index_interval, const int num_lookups) {
+    const int offset = 4 * 1024;
+    string index_filename = filename + ".idx";
+    BufferArena::ThreadCache cache(buffer_arena);
+    auto data = cache.Acquire(offset);
+
+    {
+        fstream file_handle(filename, fstream::out | fstream::trunc | fstream::binary);
+        LsnIndex index(index_interval);
+        GatherWriter writer(GatherWriter::StreamSink(file_handle));
+        long long file_offset = 0;
+        for (long long lsn = 1; lsn <= num_records; ++lsn) {
+            RecordHeader header{ lsn, offset, 0 };
+            std::fill(data.begin(), data.end(), (char)('A' + (lsn % 26)));
+            writer.SubmitRecord(header, data.Data());
+            writer.Flush();
+            index.Add(header, file_offset);
+            file_offset += sizeof(header) + offset;
+
+            // persist halfway, recovery has to index the rest.
+            if (lsn == num_records / 2) {
+                index.Save(index_filename);
+            }
+        }
+    }
+
+    ifstream file(filename, fstream::in | fstream::binary);
+    auto start_time = chrono::high_resolution_clock::now();
+    LsnIndex index = LsnIndex::Load(index_filename);
+    index.Recover(file);
+    auto end_time = chrono::high_resolution_clock::now();
+    EXPECT_EQ(num_records, index.GetLastLsn());
+    std::cout << filename << " index recovery: " << index.GetEntryCount() << " entries, "
+        << (end_time - start_time).count() / 1000 << " micro-secs" << std::endl;
+
+    std::mt19937_64 random(num_records);
+    std::uniform_int_distribution<long long> lsns(1, num_records);
+    MetricRecorder indexed_recorder(num_lookups);
+    MetricRecorder scan_recorder(num_lookups);
+    auto clock = std::chrono::high_resolution_clock();
+
+    for (int i = 0; i < num_lookups; ++i) {
+        long long lsn = lsns(random);
+        RecordHeader header;
+
+        auto start_time = clock.now();
+        bool found = index.Seek(file, lsn, header) && file.read(data.Data(), offset);
+        auto end_time = clock.now();
+        indexed_recorder.Add((int)std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time).count());
+        EXPECT_TRUE(found && header.lsn == lsn && data.Data()[0] == (char)('A' + (lsn % 26)));
+
+        start_time = clock.now();
+        found = scan_to_record(file, lsn, header) && file.read(data.Data(), offset);
+        end_time = clock.now();
+        scan_recorder.Add((int)std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time).count());
+        EXPECT_TRUE(found && header.lsn == lsn && data.Data()[0] == (char)('A' + (lsn % 26)));
+    }
+
+    std::cout << "Indexed lookup latency, every " << index_interval << " records:" << std::endl;
+    PrintHistogram(std::vector<MetricRecorder>{ indexed_recorder }, "lookup_indexed", { { "interval", to_string(index_interval) } });
+    std::cout << "Linear scan lookup latency:" << std::endl;
+    PrintHistogram(std::vector<MetricRecorder>{ scan_recorder }, "lookup_scan");
+
+    std::remove(index_filename.c_str());
+}
+
+TEST(fstream, lookup_records_indexed_vs_scan) {
+    string filename = "file9.log";
+    lookup_records(filename, 64 * 1024, 64, 200); // 256 MB
+    std::remove(filename.c_str());
+}
+
+
+// Fills `block` with text WAL records, which unlike a run of one character compress the way real records do:
+// repeating field names and tables with varying keys and values.
+size_t fill_log_records(char * block, size_t block_size, int thread_index, long long & lsn) {
+    const char * ops[]{ "INSERT", "UPDATE", "DELETE" };
+    const char * statuses[]{ "pending", "shipped", "delivered", "cancelled" };
+    char record[256];
+    size_t pos = 0;
+    while (true) {
+        int len = snprintf(record, sizeof(record),
+            "lsn=%lld thread=%d op=%s table=orders key=%lld customer=%lld qty=%d price=%d.%02d status=%s\n",
+            lsn, thread_index, ops[lsn % 3], (lsn * 7919) % 1000003, (lsn * 104729) % 50021,
+            (int)(lsn % 50) + 1, (int)((lsn * 31) % 1000), (int)(lsn % 100), statuses[(lsn / 7) % 4]);
+        if (pos + len > block_size) {
+            break;
+        }
+
+        memcpy(block + pos, record, len);
+        pos += len;
+        ++lsn;
+    }
+    return pos;
+}
+
+// Each writer groups records into 64 KB blocks and commits one block at a time.
+// With `compress` the block is compressed in the group flush, before taking the file lock; blocks that do not
+// shrink are stored as is. Every block is framed by CompressedBlockHeader so the log stays seekable per block.
+void append_blocks_concurrently(string filename, const int data_in_gb, const int num_threads, bool compress) {
+    const int block_size = 64 * 1024;
+    const int distinct_blocks = 16;
+    const int num_blocks_each_thread = (data_in_gb * 1024 * ((1024 * 1024) / (num_threads * block_size)));
+    std::vector<MetricRecorder> recorders;
+    for (int i = 0; i < num_threads; ++i) {
+        recorders.push_back(MetricRecorder(num_blocks_each_thread));
+    }
+
+    std::atomic<long long> raw_bytes(0);
+    std::atomic<long long> stored_bytes(0);
+    std::atomic<long long> compress_micros(0);
+    {
+        fstream file_handle(filename, fstream::app | fstream::binary);
+        std::mutex file_mutex;
+
+        auto write_file_fn = [&](int index) {
+            MetricRecorder & recorder = recorders[index];
+            BufferArena::ThreadCache cache(buffer_arena);
+            auto compressed = cache.Acquire(block_size);
+            LzCodec codec;
+            GatherWriter writer(GatherWriter::StreamSink(file_handle));
+
+            // records are generated up front and cycled through, so formatting them is not measured.
+            vector<BufferArena::Block> raw_blocks;
+            vector<int> raw_sizes;
+            raw_blocks.reserve(distinct_blocks);
+            long long lsn = 0;
+            for (int b = 0; b < distinct_blocks; ++b) {
+                raw_blocks.push_back(cache.Acquire(block_size));
+                raw_sizes.push_back((int)fill_log_records(raw_blocks.back().Data(), block_size, index, lsn));
+            }
+            long long my_raw_bytes = 0, my_stored_bytes = 0, my_compress_micros = 0;
+            auto clock = std::chrono::high_resolution_clock();
+
+            for (int b = 0; b < num_blocks_each_thread; ++b) {
+                auto & raw = raw_blocks[b % distinct_blocks];
+                int raw_size = raw_sizes[b % distinct_blocks];
+
+                auto start_time = clock.now();
+                CompressedBlockHeader header{ raw_size, raw_size, 0, LzCodec::Checksum(raw.Data(), raw_size) };
+                if (compress) {
+                    // capacity one byte under raw size: no point storing a block which does not shrink compressed.
+                    auto compress_start = clock.now();
+                    size_t size = raw_size > 1 ? codec.Compress(raw.Data(), raw_size, compressed.Data(), raw_size - 1) : 0;
+                    my_compress_micros += std::chrono::duration_cast<std::chrono::microseconds>(clock.now() - compress_start).count();
+                    if (size != 0) {
+                        header.storedSize = (int)size;
+                        header.compressed = 1;
+                    }
+                }
+
+                Fragment fragments[]{
+                    { (const char *)&header, sizeof(header) },
+                    { header.compressed ? compressed.Data() : raw.Data(), (size_t)header.storedSize }
+                };
+                {
+                    std::lock_guard<std::mutex> lock(file_mutex);
+                    writer.Submit(fragments, 2);
+                    writer.Flush();
+                    file_handle.flush();
+                }
+
+                auto end_time = clock.now();
+                recorder.Add((int)std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time).count());
+                my_raw_bytes += raw_size;
+                my_stored_bytes += sizeof(header) + header.storedSize;
+            }
+
+            raw_bytes += my_raw_bytes;
+            stored_bytes += my_stored_bytes;
+            compress_micros += my_compress_micros;
+        };
+
+        auto start_time = chrono::high_resolution_clock::now();
+        vector<thread> writer_threads;
+        for (int i = 0; i < num_threads; ++i) {
+            writer_threads.push_back(std::thread(write_file_fn, i));
+        }
+
+        for (int i = 0; i < num_threads; ++i) {
+            writer_threads[i].join();
+        }
+
+        auto end_time = chrono::high_resolution_clock::now();
+        auto micros = (end_time - start_time).count() / 1000;
+
+        std::cout << filename << " Data written : " << data_in_gb << " GB, " << num_threads << " threads "
+            << ", block " << block_size << " bytes " << ", compress " << (compress ? "true " : "false ");
+        std::cout << "Time taken: " << micros << " micro-secs"
+            << ", raw MB/s " << (raw_bytes / (double)micros)
+            << ", compression ratio " << ((double)raw_bytes / stored_bytes)
+            << ", compression cpu " << compress_micros << " micro-secs" << std::endl;
+    }
+
+    // read back block by block, skipping by stored size.
+    {
+        ifstream file(filename, fstream::in | fstream::binary);
+        file.seekg(0, ios_base::end);
+        EXPECT_EQ(stored_bytes.load(), file.tellg());
+        file.seekg(0, ios_base::beg);
+
+        BufferArena::ThreadCache cache(buffer_arena);
+        auto stored = cache.Acquire(block_size);
+        auto raw = cache.Acquire(block_size);
+        for (long long i = 0; i < (long long)num_blocks_each_thread * num_threads; ++i) {
+            CompressedBlockHeader header;
+            file.read((char *)&header, sizeof(header));
+            bool valid = file && header.storedSize <= block_size && header.rawSize <= block_size;
+            if (valid) {
+                file.read(stored.Data(), header.storedSize);
+                size_t raw_size = header.storedSize;
+                const char * data = stored.Data();
+                if (header.compressed) {
+                    raw_size = LzCodec::Decompress(stored.Data(), header.storedSize, raw.Data(), block_size);
+                    data = raw.Data();
+                }
+                valid = file && raw_size == header.rawSize && LzCodec::Checksum(data, raw_size) == header.checksum;
+            }
+
+            EXPECT_TRUE(valid);
+            if (!valid) {
+                std::cout << "corruption detected !!!" << std::endl;
+                break;
+            }
+        }
+    }
+
+    // print the block commit latency histogram
+    PrintHistogram(recorders, "append_blocks", { { "gb", to_string(data_in_gb) }, { "threads", to_string(num_threads) },
+        { "compress", compress ? "true" : "false" } });
+}
+
+TEST(fstream, append_blocks_compressed) {
+    string filename = "file10.log";
+    const int data_in_gb = 2;
+    for (int num_threads : {1, 4}) {
+        for (bool compress : {false, true}) {
+            {
+                fstream file(filename, fstream::in | fstream::out | fstream::trunc | fstream::binary);
+            }
+            append_blocks_concurrently(filename, data_in_gb, num_threads, compress);
+        }
+    }
+
+    std::remove(filename.c_str());
+}
+
+
+std::map<std::string, std::vector<HistogramSnapshot>> load_snapshots(const string & dir) {
+    std::map<std::string, std::vector<HistogramSnapshot>> runs;
+    for (auto & entry : fs::directory_iterator(dir)) {
+        if (entry.path().extension() == HistogramSnapshot::Extension()) {
+            auto snapshot = HistogramSnapshot::Load(entry.path().string());
+            runs[snapshot.Key()].push_back(snapshot);
+        }
+    }
+    return runs;
+}
+
+// Compares runs saved with LOGPOC_SNAPSHOT_DIR: LOGPOC_BASELINE_DIR against LOGPOC_CANDIDATE_DIR.
+// Fails on any percentile slower by more than LOGPOC_REGRESSION_THRESHOLD (relative, default 0.1) with 95% confidence.
+TEST(snapshot, compare_runs) {
+    const char * baseline_dir = getenv("LOGPOC_BASELINE_DIR");
+    const char * candidate_dir = getenv("LOGPOC_CANDIDATE_DIR");
+    if (baseline_dir == nullptr || candidate_dir == nullptr) {
+        std::cout << "Set LOGPOC_BASELINE_DIR and LOGPOC_CANDIDATE_DIR to compare saved runs." << std::endl;
+        return;
+    }
+
+    const char * threshold_env = getenv("LOGPOC_REGRESSION_THRESHOLD");
+    double threshold = threshold_env != nullptr ? atof(threshold_env) : 0.1;
+
+    auto baseline = load_snapshots(baseline_dir);
+    auto candidate = load_snapshots(candidate_dir);
+
+    // a scenario which disappeared or crashed in the candidate must not pass silently.
+    for (auto & runs : baseline) {
+        if (candidate.find(runs.first) == candidate.end()) {
+            std::cout << runs.first << ": no candidate runs" << std::endl;
+            EXPECT_TRUE(false) << runs.first << " has " << runs.second.size() << " baseline runs but no candidate runs";
+        }
+    }
+
+    for (auto & runs : candidate) {
+        auto baseline_runs = baseline.find(runs.first);
+        if (baseline_runs == baseline.end()) {
+            std::cout << runs.first << ": no baseline runs" << std::endl;
+            continue;
+        }
+
+        std::cout << baseline_runs->second.size() << " baseline runs, " << runs.second.size() << " candidate runs: ";
+        auto deltas = SnapshotComparison::Compare(baseline_runs->second, runs.second, ReportedPercentiles, threshold);
+        SnapshotComparison::Print(runs.first, deltas);
+        for (auto & delta : deltas) {
+            EXPECT_FALSE(delta.regression) << runs.first << " regressed at percentile " << delta.percentile;
+        }
+    }
+}
+
+
+// Appends phases of different record sizes with one flush policy, to see how it follows a change in load.
+// Commit latency of a record is from the start of its append until the flush and sync of its group completes.
+// Reports throughput and commit latency of each phase and, for latency target, where the controller settled.
+void append_with_flush_policy(string filename, const std::vector<int> & phase_record_sizes, const int phase_mb,
+    FlushController flush_policy) {
+    const int max_record_size = *std::max_element(phase_record_sizes.begin(), phase_record_sizes.end());
+    BufferArena::ThreadCache cache(buffer_arena);
+    auto data = cache.Acquire(max_record_size);
+    std::fill(data.begin(), data.end(), 'A');
+
+    fstream file_handle(filename, fstream::app | fstream::binary);
+    FileSync sync(filename);
+    auto clock = std::chrono::high_resolution_clock();
+    long long pending_bytes = 0;
+    vector<chrono::high_resolution_clock::time_point> pending_starts;
+    pending_starts.reserve(FlushController::MaxBatchBytes / (4 * 1024));
+
+    for (size_t phase = 0; phase < phase_record_sizes.size(); ++phase) {
+        const int record_size = phase_record_sizes[phase];
+        const int num_records = (int)(((long long)phase_mb * 1024 * 1024) / record_size);
+        MetricRecorder recorder(num_records);
+        long long num_flushes = 0;
+
+        auto flush_group = [&]() {
+            file_handle.flush();
+            sync.Sync();
+            auto end_time = clock.now();
+            for (auto & start_time : pending_starts) {
+                int latency = (int)std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time).count();
+                flush_policy.OnCommit(latency);
+                recorder.Add(latency);
+            }
+            pending_starts.clear();
+            pending_bytes = 0;
+            num_flushes += 1;
+        };
+
+        auto phase_start = clock.now();
+        for (int i = 0; i < num_records; ++i) {
+            pending_starts.push_back(clock.now());
+            file_handle.write(data.Data(), record_size);
+            pending_bytes += record_size;
+
+            if (flush_policy.ShouldFlush(pending_bytes, pending_starts.front(), clock.now())) {
+                flush_group();
+            }
+        }
+
+        // rest of the phase commits as one group, whatever the policy.
+        if (!pending_starts.empty()) {
+            flush_group();
+        }
+        auto phase_end = clock.now();
+        EXPECT_TRUE(file_handle);
+
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(phase_end - phase_start).count();
+        std::cout << filename << " phase " << phase << ", size " << record_size << " bytes , flush "
+            << flush_policy.GetModeName() << " Time taken: " << micros << " micro-secs"
+            << ", MB/s " << ((double)phase_mb * 1024 * 1024 / micros) << ", flushes " << num_flushes;
+        if (flush_policy.GetMode() == FlushMode::LatencyTarget) {
+            std::cout << ", batch " << flush_policy.GetBatchBytes() << " bytes, max delay "
+                << flush_policy.GetMaxDelayMicros() << " micro-secs, last window p99 " << flush_policy.GetLastWindowP99();
+        }
+        std::cout << std::endl;
+
+        PrintHistogram(std::vector<MetricRecorder>{ recorder }, "append_flush_policy",
+            { { "flush", flush_policy.GetModeName() }, { "phase", to_string(phase) }, { "size", to_string(record_size) } });
+    }
+}
+
+TEST(fstream, append_with_adaptive_flush) {
+    string filename = "file11.log";
+    // light load, heavy load, light load again.
+    const std::vector<int> phase_record_sizes{ 4 * 1024, 64 * 1024, 4 * 1024 };
+    const int phase_mb = 512;
+    const int target_p99_micros = 500;
+
+    for (auto policy : { FlushController::EveryRecord(), FlushController::FixedBytes(16 * 1024 * 1024),
+        FlushController::LatencyTarget(target_p99_micros) }) {
+        {
+            fstream file(filename, fstream::in | fstream::out | fstream::trunc | fstream::binary);
+        }
+        append_with_flush_policy(filename, phase_record_sizes, phase_mb, policy);
+    }
+
+    std::remove(filename.c_str());
+}
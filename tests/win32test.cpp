@@ -6,9 +6,22 @@
 #include <fstream>
 #include <vector>
 #include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "BufferArena.h"
+#include "MetricRecorder.h"
+#include "HistogramSnapshot.h"
+#include "LsnIndex.h"
 
 using namespace std;
 
+// FILE_FLAG_NO_BUFFERING needs sector aligned buffers, which arena blocks are.
+static BufferArena buffer_arena;
+
+void PrintHistogram(std::vector<MetricRecorder> recorders, const std::string & scenario = "",
+    const HistogramSnapshot::Parameters & parameters = {});
+
 std::string GetLastErrorAsString()
 {
     //Get the error message, if any.
@@ -31,7 +44,8 @@ std::string GetLastErrorAsString()
 void write_win32(HANDLE fileHandle, const int data_in_gb, const char start_char)
 {
     const int offset = 8 * 1024;
-    char buffer[offset];
+    BufferArena::ThreadCache cache(buffer_arena);
+    auto buffer = cache.Acquire(offset);
 
     auto start_time = chrono::high_resolution_clock::now();
     long long myoffset = 0;
@@ -40,7 +54,7 @@ void write_win32(HANDLE fileHandle, const int data_in_gb, const char start_char)
     {
         DWORD bytesWritten;
 
-        bool error = WriteFile(fileHandle, buffer, sizeof(buffer), &bytesWritten, NULL);
+        bool error = WriteFile(fileHandle, buffer.Data(), offset, &bytesWritten, NULL);
         SetFilePointer(fileHandle, offset, 0, FILE_CURRENT);
 
         if (!error)
@@ -154,4 +168,180 @@ TEST(win32, write_preallocated_file_serial_sprase)
     CloseHandle(hfile);
 
     std::remove(filename.c_str());
-}
\ No newline at end of file
+}
+
+// NTFS deallocates whole clusters only; punch in 64 KB steps to cover any cluster size.
+const LONGLONG PunchGranularity = 64 * 1024;
+
+// Checkpoint: drops the log before `lsn` from the index, saves the index to `indexFilename`
+// and only then punches a hole over the space it used, so recovery from the saved index never reads the hole.
+// Safe while a writer keeps appending, which only touches offsets past `lsn`.
+// Returns offset up to which the file is now deallocated.
+LONGLONG TruncateBefore(HANDLE hSparseFile, LsnIndex & index, std::mutex & indexMutex, const string & indexFilename,
+    long long lsn, LONGLONG truncatedUpTo)
+{
+    long long offset;
+    LsnIndex checkpoint;
+    {
+        // copy under the lock, save outside it, so the writer's index.Add does not wait for file I/O.
+        std::lock_guard<std::mutex> lock(indexMutex);
+        offset = index.TruncateBefore(lsn);
+        checkpoint = index;
+    }
+
+    if (offset >= 0)
+    {
+        checkpoint.Save(indexFilename);
+    }
+
+    LONGLONG punchUpTo = (offset / PunchGranularity) * PunchGranularity;
+    if (offset < 0 || punchUpTo <= truncatedUpTo)
+    {
+        return truncatedUpTo;
+    }
+
+    DWORD error = SetSparseRange(hSparseFile, truncatedUpTo, punchUpTo - truncatedUpTo);
+    if (error != 0)
+    {
+        cout << "Hole punch failed: " << error << endl;
+        return truncatedUpTo;
+    }
+
+    return punchUpTo;
+}
+
+// Appends records to a sparse file while, with `truncate`, a checkpoint thread keeps only the last 64 MB.
+// Afterwards recovers the index from the last saved checkpoint as a restart would.
+void append_win32_with_truncation(const string & filename, const int data_in_gb, bool truncate)
+{
+    const string index_filename = filename + ".idx";
+    const int offset = 4 * 1024;
+    const int record_size = sizeof(RecordHeader) + offset;
+    const long long keep_records = (64LL * 1024 * 1024) / record_size;
+    const int num_records = (int)((data_in_gb * 1024LL * 1024 * 1024) / record_size);
+    MetricRecorder recorder(num_records);
+    LsnIndex index;
+    std::mutex index_mutex;
+    std::atomic<bool> done(false);
+    std::atomic<long long> checkpoints(0);
+    std::atomic<LONGLONG> truncated_up_to(0);
+
+    wstring wfilename(filename.begin(), filename.end());
+    auto hfile = CreateSparseFile(wfilename.c_str());
+    ASSERT_NE(INVALID_HANDLE_VALUE, hfile);
+
+    auto truncate_fn = [&]() {
+        // own handle, so hole punching does not serialize with appends on the writer's handle.
+        auto htruncate = CreateFileA(filename.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        EXPECT_NE(INVALID_HANDLE_VALUE, htruncate);
+
+        while (!done)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            long long checkpoint_lsn;
+            {
+                std::lock_guard<std::mutex> lock(index_mutex);
+                checkpoint_lsn = index.GetLastLsn() - keep_records;
+            }
+
+            if (checkpoint_lsn > 0)
+            {
+                truncated_up_to = TruncateBefore(htruncate, index, index_mutex, index_filename, checkpoint_lsn,
+                    truncated_up_to);
+                checkpoints += 1;
+            }
+        }
+
+        CloseHandle(htruncate);
+    };
+
+    thread truncate_thread;
+    if (truncate)
+    {
+        truncate_thread = thread(truncate_fn);
+    }
+
+    BufferArena::ThreadCache cache(buffer_arena);
+    auto record = cache.Acquire(record_size);
+    std::fill(record.begin(), record.end(), 'A');
+    auto clock = std::chrono::high_resolution_clock();
+    long long file_offset = 0;
+    bool success = true;
+
+    auto start_time = chrono::high_resolution_clock::now();
+    for (long long lsn = 1; lsn <= num_records && success; ++lsn)
+    {
+        RecordHeader header{ lsn, offset, 0 };
+        memcpy(record.Data(), &header, sizeof(header));
+
+        auto start_time = clock.now();
+        DWORD bytesWritten;
+        success = WriteFile(hfile, record.Data(), record_size, &bytesWritten, NULL);
+        {
+            std::lock_guard<std::mutex> lock(index_mutex);
+            index.Add(header, file_offset);
+        }
+        auto end_time = clock.now();
+
+        if (!success)
+        {
+            cout << GetLastErrorAsString() << endl;
+            break;
+        }
+
+        file_offset += record_size;
+        recorder.Add((int)std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time).count());
+    }
+    auto end_time = chrono::high_resolution_clock::now();
+
+    done = true;
+    if (truncate_thread.joinable())
+    {
+        truncate_thread.join();
+    }
+
+    DWORD allocatedHigh = 0;
+    LONGLONG allocated = GetCompressedFileSizeA(filename.c_str(), &allocatedHigh);
+    allocated |= ((LONGLONG)allocatedHigh) << 32;
+    CloseHandle(hfile);
+
+    EXPECT_TRUE(success);
+    std::cout << filename << " Data written : " << data_in_gb << " GB, 1 threads , size " << record_size << " bytes "
+              << ", truncate " << (truncate ? "true " : "false ");
+    std::cout << "Time taken: " << (end_time - start_time).count() / 1000 << " micro-secs"
+              << ", checkpoints " << checkpoints.load() << ", truncated up to " << truncated_up_to.load()
+              << " bytes, allocated " << allocated << " bytes" << std::endl;
+
+    if (success)
+    {
+        PrintHistogram(std::vector<MetricRecorder>{ recorder }, "win32_append_truncation",
+            { { "gb", to_string(data_in_gb) }, { "truncate", truncate ? "true" : "false" } });
+    }
+
+    if (truncate && checkpoints > 0)
+    {
+        ifstream log(filename, fstream::in | fstream::binary);
+        LsnIndex recovered = LsnIndex::Load(index_filename);
+        EXPECT_LE(truncated_up_to.load(), recovered.GetStartOffset());
+        recovered.Recover(log);
+        EXPECT_EQ(index.GetLastLsn(), recovered.GetLastLsn());
+        EXPECT_EQ(index.GetScannedOffset(), recovered.GetScannedOffset());
+    }
+    std::remove(index_filename.c_str());
+}
+
+// Foreground append latency with and without checkpoint truncation running alongside.
+TEST(win32, append_with_concurrent_truncation)
+{
+    string filename = "file10.log";
+    const int data_in_gb = 2;
+
+    for (bool truncate : {false, true})
+    {
+        std::remove(filename.c_str());
+        append_win32_with_truncation(filename, data_in_gb, truncate);
+    }
+
+    std::remove(filename.c_str());
+}